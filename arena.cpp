@@ -0,0 +1,130 @@
+#include <cstdlib>
+#include <new>
+#include "arena.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Smallest block to ask the heap for
+static size_t const min_block_size = 64 * 1024;
+
+// Heap allocations for solver storage, per thread
+static thread_local unsigned long heap_count = 0;
+
+// Constructor
+arena::arena()
+    : blocks_(NULL), used_(0), retired_(0)
+{
+}
+
+// Copies start out empty (storage is never shared)
+arena::arena(arena const &)
+    : blocks_(NULL), used_(0), retired_(0)
+{
+}
+
+arena &arena::operator=(arena const &)
+{
+    return *this;
+}
+
+// Destructor
+arena::~arena()
+{
+    release();
+}
+
+// Carve out bytes, aligned to align (a power of 2)
+void *arena::allocate(size_t bytes, size_t align)
+{
+    size_t start = (used_ + align - 1) & ~(align - 1);
+    if (!blocks_ || (start + bytes > blocks_->size))
+    {
+        grow(bytes);
+        start = 0;
+    }
+
+    // Data follows the header, at the heap's own alignment
+    used_ = start + bytes;
+    return (char *)(blocks_ + 1) + start;
+}
+
+// Recycle all storage (anything still using it must be gone)
+void arena::reset()
+{
+    // Merge blocks, so the same amount of storage fits in one next time
+    if (blocks_ && blocks_->next)
+    {
+        size_t total = 0;
+        for (block_t *cur = blocks_; cur; cur = cur->next)
+        {
+            total += cur->size;
+        }
+        release();
+        grow(total);
+    }
+    used_ = 0;
+    retired_ = 0;
+}
+
+// Bytes handed out since last reset
+size_t arena::bytes_used() const
+{
+    return retired_ + used_;
+}
+
+// Heap allocations made for solver storage on the calling thread
+unsigned long arena::heap_allocations()
+{
+    return heap_count;
+}
+
+// Heap storage outside of any arena, counted
+void *arena::heap_allocate(size_t bytes)
+{
+    heap_count++;
+    return ::operator new(bytes);
+}
+
+void arena::heap_free(void *data)
+{
+    ::operator delete(data);
+}
+
+// Add a block with room for at least bytes
+void arena::grow(size_t bytes)
+{
+    // At least double the total, so a puzzle needs few blocks
+    size_t size = min_block_size;
+    for (block_t *cur = blocks_; cur; cur = cur->next)
+    {
+        size += cur->size;
+    }
+    if (size < bytes)
+    {
+        size = bytes;
+    }
+
+    block_t *fresh = (block_t *)arena::heap_allocate(sizeof(block_t) + size);
+    fresh->next = blocks_;
+    fresh->size = size;
+    blocks_ = fresh;
+    retired_ += used_;
+    used_ = 0;
+}
+
+// Free all blocks
+void arena::release()
+{
+    while (blocks_)
+    {
+        block_t *next = blocks_->next;
+        arena::heap_free(blocks_);
+        blocks_ = next;
+    }
+    used_ = 0;
+    retired_ = 0;
+}
+
+};
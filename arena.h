@@ -0,0 +1,139 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace nonogram
+{
+
+// Bump allocator for per-puzzle storage
+//
+// Memory is carved out of large blocks, and individual frees are ignored.
+// reset() recycles everything at once; when more than one block was needed,
+// they are merged into a single block big enough for the whole puzzle, so
+// a run of similar puzzles settles down to no heap allocations at all.
+class arena
+{
+public:
+
+    // Constructor
+    arena();
+
+    // Copies start out empty (storage is never shared)
+    arena(arena const &other);
+    arena &operator=(arena const &other);
+
+    // Destructor
+    ~arena();
+
+    // Carve out bytes, aligned to align (a power of 2)
+    void *allocate(size_t bytes, size_t align);
+
+    // Recycle all storage (anything still using it must be gone)
+    void reset();
+
+    // Bytes handed out since last reset
+    size_t bytes_used() const;
+
+    // Heap allocations made for solver storage on the calling thread
+    // (arena blocks, and storage outside of any arena)
+    static unsigned long heap_allocations();
+
+    // Heap storage outside of any arena, counted
+    static void *heap_allocate(size_t bytes);
+    static void heap_free(void *data);
+
+private:
+
+    // Block header, followed by block data
+    typedef struct block
+    {
+        struct block *next;
+        size_t size;
+    } block_t;
+
+    // Add a block with room for at least bytes
+    void grow(size_t bytes);
+
+    // Free all blocks
+    void release();
+
+    // Blocks, newest first
+    block_t *blocks_;
+
+    // Bytes used in newest block, and in all older blocks
+    size_t used_;
+    size_t retired_;
+};
+
+// Standard allocator drawing on an arena (or the heap, with no arena)
+//
+// Copies of containers (for parallel search branches) go to the heap, so
+// an arena is only ever used by the thread which owns it.
+template <typename T>
+class arena_allocator
+{
+public:
+
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    // Constructors
+    arena_allocator() : arena_(NULL) {}
+    arena_allocator(arena *mem) : arena_(mem) {}
+    template <typename U>
+    arena_allocator(arena_allocator<U> const &other) : arena_(other.source()) {}
+
+    T *allocate(size_t n)
+    {
+        if (arena_)
+        {
+            return (T *)arena_->allocate(n * sizeof(T), alignof(T));
+        }
+        return (T *)arena::heap_allocate(n * sizeof(T));
+    }
+
+    void deallocate(T *data, size_t)
+    {
+        if (!arena_)
+        {
+            arena::heap_free(data);
+        }
+    }
+
+    arena_allocator select_on_container_copy_construction() const
+    {
+        return arena_allocator();
+    }
+
+    // Arena in use (NULL for heap)
+    arena *source() const { return arena_; }
+
+private:
+
+    arena *arena_;
+};
+
+template <typename T, typename U>
+bool operator==(arena_allocator<T> const &a, arena_allocator<U> const &b)
+{
+    return a.source() == b.source();
+}
+
+template <typename T, typename U>
+bool operator!=(arena_allocator<T> const &a, arena_allocator<U> const &b)
+{
+    return a.source() != b.source();
+}
+
+// Vector drawing on an arena (nested vectors need their own arena passed in)
+template <typename T>
+using arena_vector = std::vector<T, arena_allocator<T> >;
+
+};
+
+#endif
@@ -0,0 +1,409 @@
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.h"
+#include "solver.h"
+#include "tools.h"
+using namespace std;
+using namespace nonogram;
+
+// Show command line usage
+static void usage(char const *name)
+{
+    cerr << "Usage: " << name << " [-e patterns|dp] [-b first|fewest|cells]"
+         << " [-p seconds] [-w] [-s limit] [-d seconds] [-g guesses] [-P]"
+         << " [-j threads] [-m MB] [-t entries] [-l list]"
+         << " <dir|glob|puzzle.in|puzzle.nonb|corpus> ..." << endl;
+    cerr << "  -e  Line solving engine (default patterns)" << endl;
+    cerr << "  -b  Branching strategy for guesses (default first)" << endl;
+    cerr << "  -p  Time to spend probing cells before each guess (default 0,"
+         << " none)" << endl;
+    cerr << "  -w  Search the whole puzzle as one, without splitting off"
+         << " independent parts" << endl;
+    cerr << "  -s  Count solutions up to limit, 2 to check one is unique"
+         << " (default 1)," << endl;
+    cerr << "      listing the first two found" << endl;
+    cerr << "  -d  Seconds allowed per puzzle before stopping (default 0, no"
+         << " limit)" << endl;
+    cerr << "  -g  Guesses allowed per puzzle before stopping (default 0, no"
+         << " limit)" << endl;
+    cerr << "  -P  Add time in each stage, and counters, to each result"
+         << endl;
+    cerr << "  -j  Worker threads (default one per core)" << endl;
+    cerr << "  -m  Pattern cache size, shared by all puzzles (default "
+         << (pattern_cache::default_max_bytes >> 20) << ")" << endl;
+    cerr << "  -t  Line memo entries per solver, 0 for none (default "
+         << solver::default_memo_slots << ")" << endl;
+    cerr << "  -l  File with one puzzle path per line (- for stdin)" << endl;
+    cerr << "A corpus file holds any number of puzzles, each after a line of"
+         << " --- and an optional name" << endl;
+    exit(1);
+}
+
+// Add every path listed in a file
+static void add_list(vector<string> &files, istream &list)
+{
+    string line;
+    while (getline(list, line))
+    {
+        if (line.size() > 0)
+        {
+            add_path(files, line);
+        }
+    }
+}
+
+// Puzzles of every file in turn, shared by all workers, with the reader
+// for the file being read, and the number of puzzles read from it so far
+typedef struct
+{
+    mutex lock;
+    vector<string> const *files;
+    size_t file;
+    bool open;
+    puzzle_reader reader;
+    size_t count;
+} puzzle_stream_t;
+
+// Take the next puzzle, with where it came from (false once none remain).
+// A binary image is left for the solver to map, so only its file name is
+// given. A file that can't be read gives an error in place of its next
+// puzzle, and the rest of it is skipped.
+static bool next_puzzle(puzzle_stream_t &stream, puzzle_t &puzzle,
+                        bool &image, string &filename, size_t &index,
+                        string &error)
+{
+    lock_guard<mutex> lock(stream.lock);
+    while (stream.file < stream.files->size())
+    {
+        filename = (*stream.files)[stream.file];
+        index = stream.count;
+        error.clear();
+        image = false;
+        try
+        {
+            if (!stream.open && puzzle_image::recognize(filename.c_str()))
+            {
+                image = true;
+                index = 0;
+                stream.file++;
+                return true;
+            }
+            if (!stream.open)
+            {
+                stream.reader.open(filename.c_str());
+                stream.open = true;
+                stream.count = 0;
+                index = 0;
+            }
+            if (stream.reader.next(puzzle))
+            {
+                stream.count++;
+                return true;
+            }
+        }
+        catch (exception &e)
+        {
+            error = e.what();
+        }
+
+        // On to the next file
+        stream.reader.close();
+        stream.open = false;
+        stream.file++;
+        if (!error.empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Solve a single puzzle, reusing a solver from earlier puzzles, and format
+// the result as a JSON line
+static string solve_one(solver &app, puzzle_t const &puzzle, bool image,
+                        string const &filename, size_t index,
+                        string const &error, engine_t engine,
+                        bool show_profile)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), ",\"puzzle\":%zu", index);
+    string line = "{\"file\":" + json_string(filename) + buf;
+    if (error.empty() && !image && !puzzle.name.empty())
+    {
+        line += ",\"name\":" + json_string(puzzle.name);
+    }
+    unsigned long allocations = arena::heap_allocations();
+
+    try
+    {
+        if (!error.empty())
+        {
+            throw runtime_error(error);
+        }
+        if (image)
+        {
+            app.load(filename.c_str(), engine);
+        }
+        else
+        {
+            app.load(puzzle, engine);
+        }
+        result_t result = app.solve();
+
+        // Heap allocations for solver storage, which drop to zero once the
+        // solver has seen a puzzle at least this big, and the cache holds
+        // its rules
+        allocations = arena::heap_allocations() - allocations;
+
+        char const *status = result.solved ? "solved" : "unsolved";
+        if (result.status == STATUS_TIMEOUT)
+        {
+            status = "timeout";
+        }
+        snprintf(buf, sizeof(buf),
+                 ",\"status\":\"%s\",\"engine\":\"%s\",\"complete\":%.1f"
+                 ",\"seconds\":%.6f,\"guesses\":%lu,\"memo_hits\":%lu"
+                 ",\"memo_misses\":%lu,\"probes\":%lu,\"components\":%lu"
+                 ",\"solutions\":%zu,\"allocations\":%lu",
+                 status, engine_name(app.engine()), result.complete,
+                 result.seconds, result.guesses,
+                 result.memo_hits, result.memo_misses, result.probes,
+                 result.components, result.solutions, allocations);
+        line += buf;
+        if (app.solution(0))
+        {
+            line += ",\"solution_boards\":" + solutions_json(app);
+        }
+        if (show_profile)
+        {
+            line += ",\"profile\":" + app.profiling().json();
+        }
+        line += "}";
+    }
+    catch (exception &e)
+    {
+        line += ",\"status\":\"error\",\"error\":" + json_string(e.what()) + "}";
+    }
+
+    return line;
+}
+
+int main(int argc, char **argv)
+{
+    engine_t engine = ENGINE_PATTERNS;
+    branch_t branching = BRANCH_FIRST;
+    double probe_seconds = 0;
+    bool decompose = true;
+    size_t solution_limit = 1;
+    limits_t limits = { 0, 0, NULL };
+    bool show_profile = false;
+    unsigned nthreads = thread::hardware_concurrency();
+    size_t cache_bytes = pattern_cache::default_max_bytes;
+    size_t memo_slots = solver::default_memo_slots;
+    vector<string> files;
+    unsigned long number;
+
+    // Parse command line
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-e") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!engine_named(argv[i], engine))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!branching_named(argv[i], branching))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            probe_seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            decompose = false;
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 1, ULONG_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            solution_limit = number;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            limits.seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, ULONG_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            limits.guesses = number;
+        }
+        else if (strcmp(argv[i], "-P") == 0)
+        {
+            show_profile = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, max_threads, number))
+            {
+                usage(argv[0]);
+            }
+            nthreads = number;
+        }
+        else if (strcmp(argv[i], "-m") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, SIZE_MAX >> 20, number))
+            {
+                usage(argv[0]);
+            }
+            cache_bytes = (size_t)number << 20;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, UINT32_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            memo_slots = number;
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (strcmp(argv[i], "-") == 0)
+            {
+                add_list(files, cin);
+            }
+            else
+            {
+                ifstream list(argv[i]);
+                if (!list.good())
+                {
+                    cerr << "Cannot open list " << argv[i] << endl;
+                    return 1;
+                }
+                add_list(files, list);
+            }
+        }
+        else
+        {
+            add_path(files, argv[i]);
+        }
+    }
+
+    // Sanity check
+    if (files.empty())
+    {
+        cerr << "No input files specified" << endl;
+        usage(argv[0]);
+    }
+    if (nthreads == 0)
+    {
+        nthreads = 1;
+    }
+
+    // Workers pull the next puzzle until none remain, and stream results
+    // as each one finishes (each worker keeps one solver for all of them,
+    // and all share one pattern cache)
+    pattern_cache cache(cache_bytes);
+    puzzle_stream_t stream;
+    stream.files = &files;
+    stream.file = 0;
+    stream.open = false;
+    stream.count = 0;
+    mutex output;
+    vector<thread> workers;
+    for (unsigned t = 0; t < nthreads; t++)
+    {
+        workers.push_back(thread([&]()
+        {
+            solver app;
+            app.set_cache(&cache);
+            app.set_memo_size(memo_slots);
+            app.set_branching(branching);
+            app.set_probing(probe_seconds);
+            app.set_decomposition(decompose);
+            app.set_solution_limit(solution_limit);
+            app.set_limits(limits);
+            puzzle_t puzzle;
+            bool image;
+            string filename;
+            size_t index;
+            string error;
+            while (next_puzzle(stream, puzzle, image, filename, index,
+                               error))
+            {
+                string line = solve_one(app, puzzle, image, filename, index,
+                                        error, engine, show_profile);
+
+                lock_guard<mutex> lock(output);
+                cout << line << endl;
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+
+    cerr << "Pattern cache: " << cache.hits() << " hits, " << cache.misses()
+         << " misses, " << cache.bytes() << " bytes" << endl;
+
+    return 0;
+}
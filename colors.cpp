@@ -1,6 +1,6 @@
-#include <iostream>
-#include <cstdlib>
 #include <cstring>
+#include <stdexcept>
+#include <string>
 #include "colors.h"
 using namespace std;
 
@@ -8,7 +8,7 @@ namespace nonogram
 {
 
 // Main color table
-color_t color_table[] =
+color_t const color_table[] =
 {
     { "",   "107", 0x0001 }, // White (empty)
     { "K",   "40", 0x0002 }, // Black (default fill)
@@ -22,16 +22,15 @@ color_t color_table[] =
 };
 
 // Color table size
-size_t color_table_size = sizeof(color_table) / sizeof(color_t);
+size_t const color_table_size = sizeof(color_table) / sizeof(color_t);
 
-// Table lookup (exit on error)
+// Table lookup (throw on error)
 int color_table_lookup(char const *token)
 {
     int idx;
     if (!color_table_lookup(token, idx))
     {
-        cerr << "Color token " << token << " not found" << endl;
-        exit(1);
+        throw runtime_error((string)"Color token " + token + " not found");
     }
     return idx;
 }
@@ -53,6 +52,22 @@ bool color_table_lookup(char const *token, int &idx)
     return false;
 }
 
+// Table lookup of a token length chars long, not null terminated (false on
+// error)
+bool color_table_lookup(char const *token, size_t length, int &idx)
+{
+    for (size_t i = 0; i < color_table_size; i++)
+    {
+        if ((strlen(color_table[i].token) == length) &&
+            (memcmp(token, color_table[i].token, length) == 0))
+        {
+            idx = i;
+            return true;
+        }
+    }
+    return false;
+}
+
 char const *color_code_by_bitmask(uint32_t bitmask)
 {
     // Look for matching token
@@ -65,8 +80,7 @@ char const *color_code_by_bitmask(uint32_t bitmask)
     }
 
     // Not found
-    cerr << "Color bitmask " << (int)bitmask << " not found" << endl;
-    exit(1);
+    throw runtime_error("Color bitmask not found");
 }
 
 };
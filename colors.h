@@ -16,16 +16,20 @@ typedef struct
 } color_t;
 
 // Main color table
-extern color_t color_table[];
+extern color_t const color_table[];
 
-extern size_t color_table_size;
+extern size_t const color_table_size;
 
-// Table lookup (exit on error)
+// Table lookup (throw on error)
 int color_table_lookup(char const *key);
 
 // Table lookup (false on error)
 bool color_table_lookup(char const *key, int &idx);
 
+// Table lookup of a token length chars long, not null terminated (false on
+// error)
+bool color_table_lookup(char const *key, size_t length, int &idx);
+
 char const *color_code_by_bitmask(uint32_t bitmask);
 
 };
@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "solver.h"
+using namespace std;
+using namespace nonogram;
+
+// Show command line usage
+static void usage(char const *name)
+{
+    cerr << "Usage: " << name << " [-r] [-o dir] <puzzle.in> ..." << endl;
+    cerr << "  -r  Store rules only, without pattern sets" << endl;
+    cerr << "  -o  Directory to write images to (default beside each"
+         << " puzzle)" << endl;
+    cerr << "Each puzzle is written to a binary image named for it, with"
+         << " .nonb in place of .in" << endl;
+    exit(1);
+}
+
+// Image name for a puzzle file
+static string image_name(string const &filename, char const *dir)
+{
+    string name = filename;
+    if (dir)
+    {
+        size_t slash = name.rfind('/');
+        if (slash != string::npos)
+        {
+            name = name.substr(slash + 1);
+        }
+        name = string(dir) + "/" + name;
+    }
+    size_t dot = name.rfind('.');
+    if ((dot != string::npos) && (name.find('/', dot) == string::npos))
+    {
+        name.resize(dot);
+    }
+    return name + ".nonb";
+}
+
+int main(int argc, char **argv)
+{
+    bool store_patterns = true;
+    char const *dir = NULL;
+    int first_file = argc;
+
+    // Parse command line
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            store_patterns = false;
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            dir = argv[i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            first_file = i;
+            break;
+        }
+    }
+    if (first_file == argc)
+    {
+        cerr << "No input file specified" << endl;
+        usage(argv[0]);
+    }
+
+    // Convert each puzzle, after the same checks the solver makes
+    int failures = 0;
+    pattern_cache cache(~(size_t)0);
+    solver app;
+    puzzle_t puzzle;
+    for (int i = first_file; i < argc; i++)
+    {
+        string image = image_name(argv[i], dir);
+        try
+        {
+            puzzle_reader reader;
+            reader.open(argv[i]);
+            if (!reader.next(puzzle))
+            {
+                throw runtime_error("Cannot read from file");
+            }
+            if (reader.next(puzzle))
+            {
+                throw runtime_error("Images hold one puzzle, not a corpus");
+            }
+            reader.close();
+            app.load(puzzle, ENGINE_DP);
+            puzzle_image::write(image.c_str(), puzzle,
+                                store_patterns ? &cache : NULL);
+            cout << argv[i] << " -> " << image << endl;
+        }
+        catch (exception &e)
+        {
+            cerr << argv[i] << ": " << e.what() << endl;
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
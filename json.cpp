@@ -0,0 +1,228 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "json.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Deepest nesting of arrays and objects accepted
+static int const max_depth = 32;
+
+// Skip spaces between JSON tokens
+void json_space(char const *&pos, char const *end)
+{
+    while ((pos < end) &&
+           ((*pos == ' ') || (*pos == '\t') || (*pos == '\r') ||
+            (*pos == '\n')))
+    {
+        pos++;
+    }
+}
+
+// Parse a JSON string, after its opening quote (false if malformed)
+static bool json_parse_string(char const *&pos, char const *end, string &out)
+{
+    out.clear();
+    while (pos < end)
+    {
+        char ch = *pos++;
+        if (ch == '"')
+        {
+            return true;
+        }
+        if (ch != '\\')
+        {
+            out += ch;
+            continue;
+        }
+        if (pos == end)
+        {
+            return false;
+        }
+        ch = *pos++;
+        switch (ch)
+        {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u':
+        {
+            // Code point as UTF-8 (surrogate pairs taken one at a time)
+            if (end - pos < 4)
+            {
+                return false;
+            }
+            char hex[5] = { pos[0], pos[1], pos[2], pos[3], 0 };
+            char *stop;
+            unsigned long code = strtoul(hex, &stop, 16);
+            if (stop != hex + 4)
+            {
+                return false;
+            }
+            pos += 4;
+            if (code < 0x80)
+            {
+                out += (char)code;
+            }
+            else if (code < 0x800)
+            {
+                out += (char)(0xc0 | (code >> 6));
+                out += (char)(0x80 | (code & 0x3f));
+            }
+            else
+            {
+                out += (char)(0xe0 | (code >> 12));
+                out += (char)(0x80 | ((code >> 6) & 0x3f));
+                out += (char)(0x80 | (code & 0x3f));
+            }
+            break;
+        }
+        default:
+            out += ch;
+            break;
+        }
+    }
+    return false;
+}
+
+// Parse a JSON value, nested depth deep (false if malformed or too deep)
+bool json_parse(char const *&pos, char const *end, json_t &value,
+                int depth)
+{
+    json_space(pos, end);
+    if ((pos == end) || (depth > max_depth))
+    {
+        return false;
+    }
+    value.items.clear();
+    value.keys.clear();
+
+    // Arrays and objects
+    char open = *pos;
+    if ((open == '[') || (open == '{'))
+    {
+        value.type = (open == '[') ? json_t::JSON_ARRAY : json_t::JSON_OBJECT;
+        char close = (open == '[') ? ']' : '}';
+        pos++;
+        json_space(pos, end);
+        if ((pos < end) && (*pos == close))
+        {
+            pos++;
+            return true;
+        }
+        while (true)
+        {
+            if (open == '{')
+            {
+                json_space(pos, end);
+                value.keys.push_back(string());
+                if ((pos == end) || (*pos++ != '"') ||
+                    !json_parse_string(pos, end, value.keys.back()))
+                {
+                    return false;
+                }
+                json_space(pos, end);
+                if ((pos == end) || (*pos++ != ':'))
+                {
+                    return false;
+                }
+            }
+            value.items.push_back(json_t());
+            if (!json_parse(pos, end, value.items.back(), depth + 1))
+            {
+                return false;
+            }
+            json_space(pos, end);
+            if (pos == end)
+            {
+                return false;
+            }
+            char next = *pos++;
+            if (next == close)
+            {
+                return true;
+            }
+            if (next != ',')
+            {
+                return false;
+            }
+        }
+    }
+
+    // Scalars
+    if (open == '"')
+    {
+        value.type = json_t::JSON_STRING;
+        pos++;
+        return json_parse_string(pos, end, value.text);
+    }
+    char const *const words[] = { "true", "false", "null" };
+    for (size_t i = 0; i < 3; i++)
+    {
+        size_t length = strlen(words[i]);
+        if (((size_t)(end - pos) >= length) &&
+            (memcmp(pos, words[i], length) == 0))
+        {
+            value.type = (i < 2) ? json_t::JSON_BOOL : json_t::JSON_NULL;
+            value.number = (i == 0);
+            pos += length;
+            return true;
+        }
+    }
+    string number;
+    while ((pos < end) && (*pos != 0) && strchr("+-0123456789.eE", *pos))
+    {
+        number += *pos++;
+    }
+    char *stop;
+    value.type = json_t::JSON_NUMBER;
+    value.number = strtod(number.c_str(), &stop);
+    return !number.empty() && (*stop == 0);
+}
+
+// Member of a JSON object (NULL if missing)
+json_t const *json_member(json_t const &object, char const *name)
+{
+    for (size_t i = 0; i < object.keys.size(); i++)
+    {
+        if (object.keys[i] == name)
+        {
+            return &object.items[i];
+        }
+    }
+    return NULL;
+}
+
+// Quote a string for JSON output
+string json_string(string const &data)
+{
+    string out = "\"";
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        char ch = data[i];
+        if ((ch == '"') || (ch == '\\'))
+        {
+            out += '\\';
+            out += ch;
+        }
+        else if ((unsigned char)ch < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out += buf;
+        }
+        else
+        {
+            out += ch;
+        }
+    }
+    return out + "\"";
+}
+
+};
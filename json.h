@@ -0,0 +1,45 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+
+namespace nonogram
+{
+
+// Parsed JSON value (just what server requests and bench results need)
+struct json_t
+{
+    typedef enum
+    {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT,
+    } type_t;
+
+    type_t type;
+    double number;                  // Number, or 1 / 0 for true / false
+    std::string text;               // String
+    std::vector<json_t> items;      // Array items, or object member values
+    std::vector<std::string> keys;  // Object member names, matching items
+};
+
+// Skip spaces between JSON tokens
+void json_space(char const *&pos, char const *end);
+
+// Parse a JSON value, nested depth deep (false if malformed or too deep)
+bool json_parse(char const *&pos, char const *end, json_t &value,
+                int depth = 0);
+
+// Member of a JSON object (NULL if missing)
+json_t const *json_member(json_t const &object, char const *name);
+
+// Quote a string for JSON output
+std::string json_string(std::string const &data);
+
+};
+
+#endif
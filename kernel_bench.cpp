@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include "colors.h"
+#include "kernels.h"
+#include "packed_patterns.h"
+#include "pattern_set.h"
+#include "tools.h"
+using namespace std;
+using namespace nonogram;
+
+// Show command line usage
+static void usage(char const *name)
+{
+    fprintf(stderr, "Usage: %s [-r reps]\n", name);
+    fprintf(stderr, "  -r  Times to run each kernel over each line"
+            " (default 20)\n");
+    fprintf(stderr, "Checks every kernel set gives the same results as the"
+            " scalar one, and the\nexit status is 1 if not\n");
+    exit(1);
+}
+
+// Line to run the kernels on: a rule with many placements, and board cells
+// ruling out some of them
+typedef struct
+{
+    char const *name;
+    size_t length;
+    vector<rule_element_t> rule;
+} line_t;
+
+// Lines for each layout: packed bits (one, two and three words), and
+// offsets (a byte and two bytes wide)
+static line_t const lines[] =
+{
+    { "packed 40", 40, { { 1, 3 }, { 1, 1 }, { 1, 2 }, { 1, 4 }, { 1, 1 },
+                         { 1, 2 } } },
+    { "packed 100", 100, { { 1, 10 }, { 1, 20 }, { 1, 5 }, { 1, 10 } } },
+    { "packed 150", 150, { { 1, 40 }, { 1, 30 }, { 1, 20 } } },
+    { "narrow 32", 32, { { 1, 3 }, { 2, 1 }, { 1, 2 }, { 3, 4 }, { 2, 1 },
+                         { 1, 2 } } },
+    { "wide 300", 300, { { 1, 100 }, { 2, 90 }, { 1, 50 }, { 3, 20 } } },
+};
+
+// Kernel results, to compare between sets
+typedef struct
+{
+    vector<uint32_t> keep;
+    vector<uint32_t> ids;
+    size_t kept;
+    vector<uint64_t> ones;
+    vector<uint64_t> zeros;
+} results_t;
+
+// Times to run each kernel
+static size_t reps = 20;
+
+// Time a piece of work, and report patterns per second
+template <typename F>
+static void report(char const *kernels, char const *line, char const *what,
+                   size_t count, F work)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t rep = 0; rep < reps; rep++)
+    {
+        work();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    double rate = (double)count * reps / elapsed.count();
+    printf("%-8s %-12s %-8s %10.1f M patterns/s\n", kernels, line, what,
+           rate / 1e6);
+}
+
+// Run one kernel set over a line, keeping its results
+static void run(kernels_t const *kern, line_t const &line,
+                pattern_set const &patterns, packed_patterns const *packed,
+                fit_t const &fit, vector<uint64_t> const &filled,
+                vector<uint64_t> const &empty, vector<uint32_t> const &ids,
+                results_t &out)
+{
+    size_t n = ids.size();
+    size_t words = (line.length + 63) / 64;
+    vector<uint32_t> scratch(n);
+    out.keep.assign(n, 0);
+
+    report(kern->name, line.name, "check", n, [&]()
+    {
+        if (packed)
+        {
+            kern->and_nonzero((uint64_t const *)packed->bits(), words,
+                              &ids[0], n, &filled[0], &empty[0],
+                              &out.keep[0]);
+        }
+        else if (line.length > 255)
+        {
+            kern->fits_wide((uint16_t const *)patterns.offsets(), &ids[0],
+                            n, fit, &out.keep[0]);
+        }
+        else
+        {
+            kern->fits_narrow((uint8_t const *)patterns.offsets(), &ids[0],
+                              n, fit, &out.keep[0]);
+        }
+    });
+
+    report(kern->name, line.name, "compact", n, [&]()
+    {
+        out.ids = ids;
+        out.kept = kern->compact(&out.ids[0], &out.keep[0], n, &scratch[0]);
+    });
+
+    if (packed)
+    {
+        report(kern->name, line.name, "reduce", n, [&]()
+        {
+            out.ones.assign(words, 0);
+            out.zeros.assign(words, 0);
+            kern->or_words((uint64_t const *)packed->bits(), words, &ids[0],
+                           n, &out.ones[0], &out.zeros[0]);
+        });
+    }
+}
+
+// Are two sets' results the same?
+static bool same(results_t const &a, results_t const &b)
+{
+    return (a.keep == b.keep) && (a.ids == b.ids) && (a.kept == b.kept) &&
+           (a.ones == b.ones) && (a.zeros == b.zeros);
+}
+
+// Measure the pattern engines' inner loops, in each kernel set this CPU
+// supports, over lines laid out as each engine stores them
+int main(int argc, char **argv)
+{
+    int opt;
+    unsigned long number;
+    while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                if (!option_number(optarg, 1, UINT32_MAX, number))
+                {
+                    usage(argv[0]);
+                }
+                reps = number;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc)
+    {
+        usage(argv[0]);
+    }
+
+    kernels_t const *sets[] = { scalar_kernels(), avx2_kernels() };
+    printf("Best kernels here: %s\n", best_kernels()->name);
+    int failures = 0;
+    for (size_t l = 0; l < sizeof(lines) / sizeof(lines[0]); l++)
+    {
+        line_t const &line = lines[l];
+        rule_t rule(line.rule.begin(), line.rule.end());
+        pattern_set patterns;
+        patterns.generate(rule, line.length);
+        bool bits = (line.name[0] == 'p');
+        packed_patterns packed;
+        if (bits)
+        {
+            packed.assign(patterns, line.length);
+        }
+
+        // Live ids in the shuffled order pruning leaves them in, and a
+        // board line with a cell in eight narrowed to one color
+        mt19937 random(l + 1);
+        vector<uint32_t> ids(patterns.size());
+        for (size_t k = 0; k < ids.size(); k++)
+        {
+            ids[k] = k;
+        }
+        shuffle(ids.begin(), ids.end(), random);
+        vector<uint32_t> cells(line.length, 0);
+        for (size_t i = 0; i < line.length; i++)
+        {
+            for (size_t e = 0; e < line.rule.size(); e++)
+            {
+                cells[i] |= color_table[line.rule[e].color_idx].bitmask;
+            }
+            cells[i] |= color_table[0].bitmask;
+            if (random() % 8 == 0)
+            {
+                cells[i] = color_table[random() % 2].bitmask;
+            }
+        }
+
+        // Cells as packed planes
+        size_t words = (line.length + 63) / 64;
+        vector<uint64_t> filled(words, 0);
+        vector<uint64_t> empty(words, 0);
+        for (size_t i = 0; i < line.length; i++)
+        {
+            uint64_t bit = (uint64_t)1 << (i % 64);
+            if ((cells[i] & color_table[1].bitmask) == 0)
+            {
+                empty[i / 64] |= bit;
+            }
+            else if ((cells[i] & color_table[0].bitmask) == 0)
+            {
+                filled[i / 64] |= bit;
+            }
+        }
+
+        // Cells as prefix counts of those each color (slot) can't cover,
+        // as pattern_set counts them
+        vector<size_t> slot_color(1, 0);
+        vector<size_t> seg_slot;
+        vector<size_t> seg_len;
+        for (size_t e = 0; e < line.rule.size(); e++)
+        {
+            size_t color = line.rule[e].color_idx;
+            size_t s = find(slot_color.begin(), slot_color.end(), color) -
+                       slot_color.begin();
+            if (s == slot_color.size())
+            {
+                slot_color.push_back(color);
+            }
+            seg_slot.push_back(s);
+            seg_len.push_back(line.rule[e].count);
+        }
+        vector<int> blocked(slot_color.size() * (line.length + 1));
+        for (size_t s = 0; s < slot_color.size(); s++)
+        {
+            int *prefix = &blocked[s * (line.length + 1)];
+            uint32_t mask = color_table[slot_color[s]].bitmask;
+            prefix[0] = 0;
+            for (size_t i = 0; i < line.length; i++)
+            {
+                prefix[i + 1] = prefix[i] + ((cells[i] & mask) == 0);
+            }
+        }
+        fit_t fit = { &blocked[0], &seg_slot[0], &seg_len[0],
+                      seg_len.size(), line.length };
+
+        printf("%s: %zu patterns\n", line.name, patterns.size());
+        results_t expected;
+        for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+        {
+            if (!sets[s])
+            {
+                continue;
+            }
+            results_t results;
+            run(sets[s], line, patterns, bits ? &packed : NULL, fit, filled,
+                empty, ids, results);
+            if (s == 0)
+            {
+                expected = results;
+            }
+            else if (!same(expected, results))
+            {
+                printf("FAIL %s kernels differ from scalar on %s\n",
+                       sets[s]->name, line.name);
+                failures++;
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
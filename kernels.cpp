@@ -0,0 +1,463 @@
+#include "kernels.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+namespace nonogram
+{
+
+//
+// Scalar
+//
+
+// Packed pattern loops take their word count as a template argument for
+// lines up to 64 and 128 cells, so the word loop unrolls away (0 for
+// longer lines, whose count comes at run time)
+template <size_t fixed>
+static void scalar_or_words(uint64_t const *bits, size_t words,
+                            uint32_t const *ids, size_t n, uint64_t *ones,
+                            uint64_t *zeros)
+{
+    words = fixed ? fixed : words;
+    for (size_t k = 0; k < n; k++)
+    {
+        uint64_t const *cur = bits + (size_t)ids[k] * words;
+        for (size_t w = 0; w < words; w++)
+        {
+            ones[w] |= cur[w];
+            zeros[w] |= ~cur[w];
+        }
+    }
+}
+
+static void scalar_or_words(uint64_t const *bits, size_t words,
+                            uint32_t const *ids, size_t n, uint64_t *ones,
+                            uint64_t *zeros)
+{
+    switch (words)
+    {
+        case 1:
+            scalar_or_words<1>(bits, words, ids, n, ones, zeros);
+            break;
+        case 2:
+            scalar_or_words<2>(bits, words, ids, n, ones, zeros);
+            break;
+        default:
+            scalar_or_words<0>(bits, words, ids, n, ones, zeros);
+    }
+}
+
+template <size_t fixed>
+static void scalar_and_nonzero(uint64_t const *bits, size_t words,
+                               uint32_t const *ids, size_t n,
+                               uint64_t const *filled, uint64_t const *empty,
+                               uint32_t *keep)
+{
+    words = fixed ? fixed : words;
+    for (size_t k = 0; k < n; k++)
+    {
+        uint64_t const *cur = bits + (size_t)ids[k] * words;
+        uint64_t conflict = 0;
+        for (size_t w = 0; w < words; w++)
+        {
+            conflict |= (cur[w] & empty[w]) | (~cur[w] & filled[w]);
+        }
+        keep[k] = -(uint32_t)(conflict == 0);
+    }
+}
+
+static void scalar_and_nonzero(uint64_t const *bits, size_t words,
+                               uint32_t const *ids, size_t n,
+                               uint64_t const *filled, uint64_t const *empty,
+                               uint32_t *keep)
+{
+    switch (words)
+    {
+        case 1:
+            scalar_and_nonzero<1>(bits, words, ids, n, filled, empty, keep);
+            break;
+        case 2:
+            scalar_and_nonzero<2>(bits, words, ids, n, filled, empty, keep);
+            break;
+        default:
+            scalar_and_nonzero<0>(bits, words, ids, n, filled, empty, keep);
+    }
+}
+
+// Blocked cell counts are never negative, so OR-ing them is nonzero if any
+// of them is
+template <typename offset_t>
+static void scalar_fits(offset_t const *offsets, uint32_t const *ids,
+                        size_t n, fit_t const &fit, uint32_t *keep)
+{
+    size_t width = fit.length + 1;
+    int const *white = fit.blocked;
+    for (size_t k = 0; k < n; k++)
+    {
+        offset_t const *cur = offsets + (size_t)ids[k] * fit.nsegs;
+        size_t end = 0;
+        int bad = 0;
+        for (size_t j = 0; (bad == 0) && (j < fit.nsegs); j++)
+        {
+            size_t start = cur[j];
+            int const *color = fit.blocked + fit.slot[j] * width;
+            bad = (white[start] - white[end]) |
+                  (color[start + fit.len[j]] - color[start]);
+            end = start + fit.len[j];
+        }
+        bad |= white[fit.length] - white[end];
+        keep[k] = -(uint32_t)(bad == 0);
+    }
+}
+
+static void scalar_fits_narrow(uint8_t const *offsets, uint32_t const *ids,
+                               size_t n, fit_t const &fit, uint32_t *keep)
+{
+    scalar_fits(offsets, ids, n, fit, keep);
+}
+
+static void scalar_fits_wide(uint16_t const *offsets, uint32_t const *ids,
+                             size_t n, fit_t const &fit, uint32_t *keep)
+{
+    scalar_fits(offsets, ids, n, fit, keep);
+}
+
+static size_t scalar_compact(uint32_t *ids, uint32_t const *keep, size_t n,
+                             uint32_t *scratch)
+{
+    // Branch free: write every id to both sides, advance only one
+    size_t kept = 0;
+    size_t culled = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t id = ids[i];
+        size_t hit = keep[i] & 1;
+        ids[kept] = id;
+        scratch[culled] = id;
+        kept += hit;
+        culled += 1 - hit;
+    }
+    for (size_t i = 0; i < culled; i++)
+    {
+        ids[kept + i] = scratch[i];
+    }
+    return kept;
+}
+
+static kernels_t const scalar_set =
+{
+    "scalar", scalar_or_words, scalar_and_nonzero, scalar_fits_narrow,
+    scalar_fits_wide, scalar_compact
+};
+
+#ifdef KERNELS_X86
+
+//
+// AVX2 (four packed patterns, or eight offset patterns, at a time)
+//
+
+// Word offsets of four packed patterns
+__attribute__((target("avx2")))
+static inline __m256i avx2_word_index(uint32_t const *ids, size_t words)
+{
+    __m128i id = _mm_loadu_si128((__m128i const *)ids);
+    return _mm256_mul_epu32(_mm256_cvtepu32_epi64(id),
+                            _mm256_set1_epi64x(words));
+}
+
+// With the word count fixed, every word's accumulators stay in registers
+// while reading each pattern once
+template <size_t fixed>
+__attribute__((target("avx2")))
+static void avx2_or_words(uint64_t const *bits, size_t words,
+                          uint32_t const *ids, size_t n, uint64_t *ones,
+                          uint64_t *zeros)
+{
+    size_t blocked = n & ~(size_t)3;
+    size_t per_pass = fixed ? fixed : 1;
+    for (size_t first = 0; first < words; first += per_pass)
+    {
+        __m256i one[fixed ? fixed : 1];
+        __m256i zero[fixed ? fixed : 1];
+        for (size_t w = 0; w < per_pass; w++)
+        {
+            one[w] = _mm256_setzero_si256();
+            zero[w] = _mm256_setzero_si256();
+        }
+        for (size_t k = 0; k < blocked; k += 4)
+        {
+            __m256i index = avx2_word_index(ids + k, words);
+            for (size_t w = 0; w < per_pass; w++)
+            {
+                __m256i cur = _mm256_i64gather_epi64(
+                    (long long const *)(bits + first + w), index, 8);
+                one[w] = _mm256_or_si256(one[w], cur);
+                zero[w] = _mm256_or_si256(zero[w], _mm256_xor_si256(cur,
+                                          _mm256_set1_epi64x(-1)));
+            }
+        }
+
+        for (size_t w = 0; w < per_pass; w++)
+        {
+            uint64_t lanes[8];
+            _mm256_storeu_si256((__m256i *)lanes, one[w]);
+            _mm256_storeu_si256((__m256i *)(lanes + 4), zero[w]);
+            ones[first + w] |= lanes[0] | lanes[1] | lanes[2] | lanes[3];
+            zeros[first + w] |= lanes[4] | lanes[5] | lanes[6] | lanes[7];
+        }
+    }
+    scalar_or_words(bits, words, ids + blocked, n - blocked, ones, zeros);
+}
+
+__attribute__((target("avx2")))
+static void avx2_or_words(uint64_t const *bits, size_t words,
+                          uint32_t const *ids, size_t n, uint64_t *ones,
+                          uint64_t *zeros)
+{
+    switch (words)
+    {
+        case 1:
+            avx2_or_words<1>(bits, words, ids, n, ones, zeros);
+            break;
+        case 2:
+            avx2_or_words<2>(bits, words, ids, n, ones, zeros);
+            break;
+        default:
+            avx2_or_words<0>(bits, words, ids, n, ones, zeros);
+    }
+}
+
+template <size_t fixed>
+__attribute__((target("avx2")))
+static void avx2_and_nonzero(uint64_t const *bits, size_t words,
+                             uint32_t const *ids, size_t n,
+                             uint64_t const *filled, uint64_t const *empty,
+                             uint32_t *keep)
+{
+    // Low half of each 64 bit lane, for 32 bit flags
+    __m256i halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    words = fixed ? fixed : words;
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256i index = avx2_word_index(ids + k, words);
+        __m256i conflict = _mm256_setzero_si256();
+        for (size_t w = 0; w < words; w++)
+        {
+            __m256i cur = _mm256_i64gather_epi64(
+                (long long const *)(bits + w), index, 8);
+            __m256i full = _mm256_set1_epi64x(filled[w]);
+            __m256i none = _mm256_set1_epi64x(empty[w]);
+            conflict = _mm256_or_si256(conflict,
+                _mm256_or_si256(_mm256_and_si256(cur, none),
+                                _mm256_andnot_si256(cur, full)));
+        }
+        __m256i flags = _mm256_cmpeq_epi64(conflict, _mm256_setzero_si256());
+        flags = _mm256_permutevar8x32_epi32(flags, halves);
+        _mm_storeu_si128((__m128i *)(keep + k),
+                         _mm256_castsi256_si128(flags));
+    }
+    scalar_and_nonzero(bits, words, ids + k, n - k, filled, empty, keep + k);
+}
+
+__attribute__((target("avx2")))
+static void avx2_and_nonzero(uint64_t const *bits, size_t words,
+                             uint32_t const *ids, size_t n,
+                             uint64_t const *filled, uint64_t const *empty,
+                             uint32_t *keep)
+{
+    switch (words)
+    {
+        case 1:
+            avx2_and_nonzero<1>(bits, words, ids, n, filled, empty, keep);
+            break;
+        case 2:
+            avx2_and_nonzero<2>(bits, words, ids, n, filled, empty, keep);
+            break;
+        default:
+            avx2_and_nonzero<0>(bits, words, ids, n, filled, empty, keep);
+    }
+}
+
+// Checks eight patterns at a time, gathering the prefix counts at their
+// segment ends, until all eight have failed
+template <typename offset_t>
+__attribute__((target("avx2")))
+static void avx2_fits(offset_t const *offsets, uint32_t const *ids,
+                      size_t n, fit_t const &fit, uint32_t *keep)
+{
+    size_t width = fit.length + 1;
+    int const *white = fit.blocked;
+    __m256i zero = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        offset_t const *cur[8];
+        for (size_t lane = 0; lane < 8; lane++)
+        {
+            cur[lane] = offsets + (size_t)ids[k + lane] * fit.nsegs;
+        }
+
+        __m256i end = zero;
+        __m256i bad = zero;
+        for (size_t j = 0; j < fit.nsegs; j++)
+        {
+            int const *color = fit.blocked + fit.slot[j] * width;
+            __m256i start = _mm256_setr_epi32(cur[0][j], cur[1][j],
+                                              cur[2][j], cur[3][j],
+                                              cur[4][j], cur[5][j],
+                                              cur[6][j], cur[7][j]);
+            __m256i stop = _mm256_add_epi32(start,
+                                            _mm256_set1_epi32(fit.len[j]));
+            __m256i gap = _mm256_sub_epi32(
+                _mm256_i32gather_epi32(white, start, 4),
+                _mm256_i32gather_epi32(white, end, 4));
+            __m256i seg = _mm256_sub_epi32(
+                _mm256_i32gather_epi32(color, stop, 4),
+                _mm256_i32gather_epi32(color, start, 4));
+            bad = _mm256_or_si256(bad, _mm256_or_si256(gap, seg));
+            end = stop;
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(bad, zero)) == 0)
+            {
+                break;
+            }
+        }
+        __m256i tail = _mm256_sub_epi32(
+            _mm256_set1_epi32(white[fit.length]),
+            _mm256_i32gather_epi32(white, end, 4));
+        bad = _mm256_or_si256(bad, tail);
+        _mm256_storeu_si256((__m256i *)(keep + k),
+                            _mm256_cmpeq_epi32(bad, zero));
+    }
+    scalar_fits(offsets, ids + k, n - k, fit, keep + k);
+}
+
+__attribute__((target("avx2")))
+static void avx2_fits_narrow(uint8_t const *offsets, uint32_t const *ids,
+                             size_t n, fit_t const &fit, uint32_t *keep)
+{
+    avx2_fits(offsets, ids, n, fit, keep);
+}
+
+__attribute__((target("avx2")))
+static void avx2_fits_wide(uint16_t const *offsets, uint32_t const *ids,
+                           size_t n, fit_t const &fit, uint32_t *keep)
+{
+    avx2_fits(offsets, ids, n, fit, keep);
+}
+
+// Lane permutations for compaction: for each 8 bit keep mask, indices of
+// the set lanes first, then the clear lanes
+typedef struct
+{
+    int32_t lanes[256][8];
+} permute_table_t;
+
+static permute_table_t const &permute_table()
+{
+    static permute_table_t const table = []()
+    {
+        permute_table_t t;
+        for (int bits = 0; bits < 256; bits++)
+        {
+            int out = 0;
+            for (int lane = 0; lane < 8; lane++)
+            {
+                if (bits & (1 << lane))
+                {
+                    t.lanes[bits][out++] = lane;
+                }
+            }
+            for (int lane = 0; lane < 8; lane++)
+            {
+                if (!(bits & (1 << lane)))
+                {
+                    t.lanes[bits][out++] = lane;
+                }
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_compact(uint32_t *ids, uint32_t const *keep, size_t n,
+                           uint32_t *scratch)
+{
+    permute_table_t const &table = permute_table();
+    size_t kept = 0;
+    size_t culled = 0;
+    size_t i = 0;
+
+    // Kept lanes are written in place, never past the block just read
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i const *)(ids + i));
+        __m256i k = _mm256_loadu_si256((__m256i const *)(keep + i));
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(k));
+        int hits = __builtin_popcount(bits);
+
+        __m256i front = _mm256_loadu_si256(
+            (__m256i const *)table.lanes[bits]);
+        __m256i back = _mm256_loadu_si256(
+            (__m256i const *)table.lanes[~bits & 0xff]);
+        _mm256_storeu_si256((__m256i *)(ids + kept),
+                            _mm256_permutevar8x32_epi32(v, front));
+        _mm256_storeu_si256((__m256i *)(scratch + culled),
+                            _mm256_permutevar8x32_epi32(v, back));
+        kept += hits;
+        culled += 8 - hits;
+    }
+    for (; i < n; i++)
+    {
+        uint32_t id = ids[i];
+        size_t hit = keep[i] & 1;
+        ids[kept] = id;
+        scratch[culled] = id;
+        kept += hit;
+        culled += 1 - hit;
+    }
+    for (size_t j = 0; j < culled; j++)
+    {
+        ids[kept + j] = scratch[j];
+    }
+    return kept;
+}
+
+static kernels_t const avx2_set =
+{
+    "avx2", avx2_or_words, avx2_and_nonzero, avx2_fits_narrow,
+    avx2_fits_wide, avx2_compact
+};
+
+#endif
+
+// Plain C++ kernels (always available)
+kernels_t const *scalar_kernels()
+{
+    return &scalar_set;
+}
+
+// AVX2 kernels (NULL if not supported by this CPU)
+kernels_t const *avx2_kernels()
+{
+#ifdef KERNELS_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return &avx2_set;
+    }
+#endif
+    return NULL;
+}
+
+// Fastest kernels supported by this CPU, picked on first use
+kernels_t const *best_kernels()
+{
+    static kernels_t const *best = avx2_kernels() ? avx2_kernels() :
+                                   scalar_kernels();
+    return best;
+}
+
+};
@@ -0,0 +1,69 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace nonogram
+{
+
+// Where a line's cells rule out offset patterns (see pattern_set)
+typedef struct
+{
+    int const *blocked; // Prefix counts of cells each prefix slot can't
+                        // cover, length + 1 per slot (slot 0 is white)
+    size_t const *slot; // Prefix slot of each segment
+    size_t const *len;  // Length of each segment
+    size_t nsegs;       // Segments per pattern
+    size_t length;      // Cells in the line
+} fit_t;
+
+// Inner loops of the pattern engines, in scalar and AVX2 flavors
+//
+// Each works on the patterns a line still allows, picked out by id, in
+// the layouts pattern_set and packed_patterns store them: words 64 bit
+// words per packed pattern, or nsegs segment starts per offset pattern, a
+// byte or two bytes each. Keep flags are all ones for patterns which
+// still match the line, and zero for the rest.
+typedef struct
+{
+    char const *name;
+
+    // OR of the words of each pattern into ones, and of their complements
+    // into zeros (both words long, and added to)
+    void (*or_words)(uint64_t const *bits, size_t words,
+                     uint32_t const *ids, size_t n, uint64_t *ones,
+                     uint64_t *zeros);
+
+    // Keep flags of packed patterns sharing no bit with empty and having
+    // every bit of filled
+    void (*and_nonzero)(uint64_t const *bits, size_t words,
+                        uint32_t const *ids, size_t n,
+                        uint64_t const *filled, uint64_t const *empty,
+                        uint32_t *keep);
+
+    // Keep flags of offset patterns with no segment, or white space
+    // between them, on a blocked cell
+    void (*fits_narrow)(uint8_t const *offsets, uint32_t const *ids,
+                        size_t n, fit_t const &fit, uint32_t *keep);
+    void (*fits_wide)(uint16_t const *offsets, uint32_t const *ids,
+                      size_t n, fit_t const &fit, uint32_t *keep);
+
+    // Move ids with keep flags set to the front, and the rest after, both
+    // in order (scratch must hold n ids). Returns the number kept.
+    size_t (*compact)(uint32_t *ids, uint32_t const *keep, size_t n,
+                      uint32_t *scratch);
+} kernels_t;
+
+// Plain C++ kernels (always available)
+kernels_t const *scalar_kernels();
+
+// Vector kernels (NULL if not supported by this CPU)
+kernels_t const *avx2_kernels();
+
+// Fastest kernels supported by this CPU, picked on first use
+kernels_t const *best_kernels();
+
+};
+
+#endif
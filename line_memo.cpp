@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstring>
+#include "line_memo.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Constructor (storage drawn from mem, or the heap for NULL)
+line_memo::line_memo(arena *mem)
+    : slots_(0), width_(0), fallback_(NULL), keys_(mem), lines_(mem)
+{
+}
+
+// Copies start out empty and small, falling back on the memo copied
+line_memo::line_memo(line_memo const &other)
+    : slots_(min(other.slots_, (size_t)branch_slots)), width_(other.width_),
+      fallback_(&other)
+{
+}
+
+// Assignment takes the other memo's size and storage
+line_memo &line_memo::operator=(line_memo const &other)
+{
+    // Storage comes from the other memo's arena from now on
+    slots_ = other.slots_;
+    width_ = other.width_;
+    fallback_ = other.fallback_;
+    keys_ = arena_vector<slot_t>(other.keys_.get_allocator());
+    lines_ = arena_vector<uint32_t>(other.lines_.get_allocator());
+    return *this;
+}
+
+// Make room for slots entries of lines up to width cells
+void line_memo::resize(size_t slots, size_t width)
+{
+    // Power of 2, so a hash maps to a slot with a mask
+    slots_ = 0;
+    if (slots > 0)
+    {
+        slots_ = 1;
+        while (slots_ * 2 <= slots)
+        {
+            slots_ *= 2;
+        }
+    }
+    width_ = width;
+    fallback_ = NULL;
+    allocate();
+}
+
+// Make room for entries, all empty
+void line_memo::allocate()
+{
+    slot_t empty = { 0, 0, SLOT_EMPTY };
+    keys_.assign(slots_, empty);
+    lines_.resize(slots_ * 2 * width_);
+}
+
+// Look up a line (false on miss), then in the memo copied
+bool line_memo::find(uint32_t rule, uint32_t const *line, size_t length,
+                     bool &consistent, uint32_t *out) const
+{
+    uint64_t hash = hash_line(rule, line, length);
+    for (line_memo const *memo = this; memo; memo = memo->fallback_)
+    {
+        if (memo->keys_.empty())
+        {
+            continue;
+        }
+        size_t slot = hash & (memo->slots_ - 1);
+        slot_t const &key = memo->keys_[slot];
+        if ((key.state == SLOT_EMPTY) || (key.hash != hash) ||
+            (key.rule != rule) ||
+            (memcmp(memo->cells(slot), line,
+                    length * sizeof(uint32_t)) != 0))
+        {
+            continue;
+        }
+
+        consistent = (key.state == SLOT_CONSISTENT);
+        if (consistent)
+        {
+            memcpy(out, memo->result(slot), length * sizeof(uint32_t));
+        }
+        return true;
+    }
+    return false;
+}
+
+// Remember a line (result only needed if consistent)
+void line_memo::store(uint32_t rule, uint32_t const *line, size_t length,
+                      bool consistent, uint32_t const *out)
+{
+    if (slots_ == 0)
+    {
+        return;
+    }
+    if (keys_.empty())
+    {
+        allocate();
+    }
+
+    uint64_t hash = hash_line(rule, line, length);
+    size_t slot = hash & (slots_ - 1);
+    slot_t &key = keys_[slot];
+    key.hash = hash;
+    key.rule = rule;
+    key.state = consistent ? SLOT_CONSISTENT : SLOT_CONTRADICTION;
+    memcpy(cells(slot), line, length * sizeof(uint32_t));
+    if (consistent)
+    {
+        memcpy(result(slot), out, length * sizeof(uint32_t));
+    }
+}
+
+// Hash rule id and cells (FNV-1a, a cell at a time)
+uint64_t line_memo::hash_line(uint32_t rule, uint32_t const *line,
+                              size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL ^ rule;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ line[i]) * 1099511628211ULL;
+    }
+
+    // Fold high bits down, as slots are picked by the low bits
+    return hash ^ (hash >> 29);
+}
+
+};
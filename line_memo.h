@@ -0,0 +1,105 @@
+#ifndef LINE_MEMO_H
+#define LINE_MEMO_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "arena.h"
+
+namespace nonogram
+{
+
+// Memo of line filtering results
+//
+// Filtering a line depends only on its rule and current cells, and search
+// keeps coming back to the same line states (every sibling guess starts
+// from the same board). Results, or contradictions, are kept in a direct
+// mapped table keyed by a hash of rule id and cells, and checked against a
+// full copy of the cells, so a hit is always exact.
+class line_memo
+{
+public:
+
+    // Constructor (storage drawn from mem, or the heap for NULL)
+    explicit line_memo(arena *mem = NULL);
+
+    // Copies (for parallel search branches) start out empty, with room for
+    // at most branch_slots entries once they store one, and look up lines
+    // they miss in the memo copied, which must outlive them and not change
+    // meanwhile
+    line_memo(line_memo const &other);
+
+    // Assignment takes the other memo's size and storage, but none of its
+    // entries
+    line_memo &operator=(line_memo const &other);
+
+    // Most entries of a copy's own
+    static size_t const branch_slots = 1 << 12;
+
+    // Make room for slots entries (rounded down to a power of 2, 0 turns
+    // the memo off) of lines up to width cells, and forget everything,
+    // including any memo copied
+    void resize(size_t slots, size_t width);
+
+    // Look up a line (false on miss). Sets consistent, and result if so.
+    bool find(uint32_t rule, uint32_t const *cells, size_t length,
+              bool &consistent, uint32_t *result) const;
+
+    // Remember a line (result only needed if consistent)
+    void store(uint32_t rule, uint32_t const *cells, size_t length,
+               bool consistent, uint32_t const *result);
+
+    // Number of slots (0 if off)
+    size_t size() const { return slots_; }
+
+private:
+
+    // Slot state
+    typedef enum
+    {
+        SLOT_EMPTY,
+        SLOT_CONSISTENT,
+        SLOT_CONTRADICTION,
+    } slot_state_t;
+
+    // Slot key
+    typedef struct
+    {
+        uint64_t hash;
+        uint32_t rule;
+        uint32_t state;
+    } slot_t;
+
+    // Make room for entries, all empty
+    void allocate();
+
+    // Hash rule id and cells
+    static uint64_t hash_line(uint32_t rule, uint32_t const *cells,
+                              size_t length);
+
+    // Cells and result stored for slot
+    uint32_t *cells(size_t slot) { return &lines_[slot * 2 * width_]; }
+    uint32_t *result(size_t slot) { return cells(slot) + width_; }
+    uint32_t const *cells(size_t slot) const
+    {
+        return &lines_[slot * 2 * width_];
+    }
+    uint32_t const *result(size_t slot) const
+    {
+        return cells(slot) + width_;
+    }
+
+    // Dimensions
+    size_t slots_;
+    size_t width_;
+
+    // Memo copied, for lines missed (NULL if not a copy)
+    line_memo const *fallback_;
+
+    // Slot keys, then cells and result for each slot
+    arena_vector<slot_t> keys_;
+    arena_vector<uint32_t> lines_;
+};
+
+};
+
+#endif
@@ -0,0 +1,306 @@
+#include "line_solver.h"
+#include "colors.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Constructor (scratch space drawn from mem, or the heap for NULL)
+line_solver::line_solver(arena *mem)
+    : seg_mask_(mem), seg_len_(mem), seg_slot_(mem), seg_gap_(mem),
+      slot_by_color_(mem), blocked_(mem), fwd_(mem), bwd_(mem), cover_(mem),
+      out_(mem), first_(mem), last_(mem), nsegs_(0), length_(0)
+{
+}
+
+// Filter a line against a rule
+bool line_solver::solve(rule_t const &rule, uint32_t const *cells,
+                        size_t length, uint32_t *result)
+{
+    uint32_t const white = color_table[0].bitmask;
+    if (!reach(rule, cells, length))
+    {
+        return false;
+    }
+    size_t width = length + 1;
+
+    // Collect union of colors for every consistent placement
+    cover_.resize(width);
+    out_.assign(length, 0);
+    for (size_t j = 0; j < nsegs_; j++)
+    {
+        size_t len = seg_len_[j];
+        if (len > length)
+        {
+            continue;
+        }
+
+        // Mark coverage of every start position reachable from both ends
+        for (size_t i = 0; i <= length; i++)
+        {
+            cover_[i] = 0;
+        }
+        for (size_t s = 0; s + len <= length; s++)
+        {
+            if (blocked(j, s, s + len) == 0 && fits_left(j, s) && fits_right(j, s))
+            {
+                cover_[s]++;
+                cover_[s + len]--;
+            }
+        }
+
+        // Stencil in this color segment
+        int depth = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            depth += cover_[i];
+            if (depth > 0)
+            {
+                out_[i] |= seg_mask_[j];
+            }
+        }
+    }
+
+    // A cell may be white if it can sit between segments j - 1 and j
+    for (size_t i = 0; i < length; i++)
+    {
+        if ((cells[i] & white) == 0)
+        {
+            continue;
+        }
+        for (size_t j = 0; j <= nsegs_; j++)
+        {
+            if (fwd_[j * width + i] && bwd_[j * width + i + 1])
+            {
+                out_[i] |= white;
+                break;
+            }
+        }
+    }
+
+    // All done
+    for (size_t i = 0; i < length; i++)
+    {
+        result[i] = out_[i];
+    }
+    return true;
+}
+
+// Find where segments can go, from each end of a line (false if nowhere)
+bool line_solver::reach(rule_t const &rule, uint32_t const *cells,
+                        size_t length)
+{
+    uint32_t const white = color_table[0].bitmask;
+
+    // Collect non-empty segments, and assign each color a prefix slot
+    slot_by_color_.assign(color_table_size, -1);
+    size_t nslots = 1;
+    slot_by_color_[0] = 0;
+    seg_mask_.clear();
+    seg_len_.clear();
+    seg_slot_.clear();
+    seg_gap_.clear();
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (rule[i].count <= 0)
+        {
+            continue;
+        }
+
+        int color = rule[i].color_idx;
+        if (slot_by_color_[color] < 0)
+        {
+            slot_by_color_[color] = nslots++;
+        }
+
+        // Ensure at least one pad space between same color segments
+        size_t gap = 0;
+        if (seg_mask_.size() && (seg_mask_.back() == color_table[color].bitmask))
+        {
+            gap = 1;
+        }
+
+        seg_mask_.push_back(color_table[color].bitmask);
+        seg_len_.push_back(rule[i].count);
+        seg_slot_.push_back(slot_by_color_[color]);
+        seg_gap_.push_back(gap);
+    }
+    nsegs_ = seg_mask_.size();
+    length_ = length;
+
+    // Prefix counts of blocked cells, per color in use
+    blocked_.resize(nslots * (length + 1));
+    for (size_t s = 0; s < nslots; s++)
+    {
+        int *prefix = &blocked_[s * (length + 1)];
+        uint32_t mask = white;
+        for (size_t j = 0; j < nsegs_; j++)
+        {
+            if (seg_slot_[j] == s)
+            {
+                mask = seg_mask_[j];
+                break;
+            }
+        }
+
+        prefix[0] = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            prefix[i + 1] = prefix[i] + ((cells[i] & mask) == 0);
+        }
+    }
+
+    // Forward pass: left-most reachability
+    size_t width = length + 1;
+    fwd_.assign((nsegs_ + 1) * width, 0);
+    for (size_t i = 0; i <= length; i++)
+    {
+        fwd_[i] = (not_white(0, i) == 0);
+    }
+    for (size_t j = 1; j <= nsegs_; j++)
+    {
+        uint8_t *row = &fwd_[j * width];
+        size_t len = seg_len_[j - 1];
+        for (size_t i = 0; i <= length; i++)
+        {
+            // Trailing white cell after segment j - 1?
+            if (i > 0 && row[i - 1] && (cells[i - 1] & white))
+            {
+                row[i] = 1;
+            }
+
+            // Or segment j - 1 ends right here?
+            else if (i >= len && blocked(j - 1, i - len, i) == 0 &&
+                     fits_left(j - 1, i - len))
+            {
+                row[i] = 1;
+            }
+        }
+    }
+
+    // Not solvable at all?
+    if (!fwd_[nsegs_ * width + length])
+    {
+        return false;
+    }
+
+    // Backward pass: right-most reachability
+    bwd_.assign((nsegs_ + 1) * width, 0);
+    for (size_t i = 0; i <= length; i++)
+    {
+        bwd_[nsegs_ * width + i] = (not_white(i, length) == 0);
+    }
+    for (size_t j = nsegs_; j-- > 0; )
+    {
+        uint8_t *row = &bwd_[j * width];
+        size_t len = seg_len_[j];
+        for (size_t i = length + 1; i-- > 0; )
+        {
+            // Leading white cell before segment j?
+            if (i < length && row[i + 1] && (cells[i] & white))
+            {
+                row[i] = 1;
+            }
+
+            // Or segment j starts right here?
+            else if (i + len <= length && blocked(j, i, i + len) == 0 &&
+                     fits_right(j, i))
+            {
+                row[i] = 1;
+            }
+        }
+    }
+    return true;
+}
+
+// Mark where a line splits into parts that can be solved separately
+bool line_solver::cuts(rule_t const &rule, uint32_t const *cells,
+                       size_t length, uint8_t *cut)
+{
+    if (!reach(rule, cells, length))
+    {
+        return false;
+    }
+
+    // First start and last end of each segment over consistent placements
+    first_.resize(nsegs_);
+    last_.resize(nsegs_);
+    for (size_t j = 0; j < nsegs_; j++)
+    {
+        size_t len = seg_len_[j];
+        first_[j] = length;
+        last_[j] = 0;
+        for (size_t s = 0; s + len <= length; s++)
+        {
+            if (blocked(j, s, s + len) == 0 && fits_left(j, s) &&
+                fits_right(j, s))
+            {
+                first_[j] = min(first_[j], s);
+                last_[j] = s + len;
+            }
+        }
+    }
+
+    // Cells before i and from i on are independent if segments that can
+    // reach cell i - 1 can't reach cell i, or the other way around, and
+    // the two either side can't come close enough to need a pad space
+    // (ranges only grow from left to right, so the first segment that can
+    // end past i - 1 decides)
+    size_t k = 0;
+    for (size_t i = 1; i < length; i++)
+    {
+        while ((k < nsegs_) && (last_[k] <= i))
+        {
+            k++;
+        }
+        cut[i] = (k == nsegs_) || (first_[k] >= i);
+        if (cut[i] && (k > 0) && (k < nsegs_) && seg_gap_[k])
+        {
+            cut[i] = (last_[k - 1] < first_[k]);
+        }
+    }
+    return true;
+}
+
+// Number of cells in [begin, end) which cannot hold segment color
+int line_solver::blocked(size_t seg, size_t begin, size_t end) const
+{
+    int const *prefix = &blocked_[seg_slot_[seg] * (length_ + 1)];
+    return prefix[end] - prefix[begin];
+}
+
+// Number of cells in [begin, end) which cannot be white (empty)
+int line_solver::not_white(size_t begin, size_t end) const
+{
+    int const *prefix = &blocked_[0];
+    return prefix[end] - prefix[begin];
+}
+
+// Can segments before seg be placed, given seg starts at start?
+bool line_solver::fits_left(size_t seg, size_t start) const
+{
+    size_t width = length_ + 1;
+    uint8_t const *row = &fwd_[seg * width];
+
+    if (seg_gap_[seg])
+    {
+        return (start >= 1) && (not_white(start - 1, start) == 0) && row[start - 1];
+    }
+    return row[start];
+}
+
+// Can segments after seg be placed, given seg starts at start?
+bool line_solver::fits_right(size_t seg, size_t start) const
+{
+    size_t width = length_ + 1;
+    uint8_t const *row = &bwd_[(seg + 1) * width];
+    size_t end = start + seg_len_[seg];
+
+    if ((seg + 1 < nsegs_) && seg_gap_[seg + 1])
+    {
+        return (end < length_) && (not_white(end, end + 1) == 0) && row[end + 1];
+    }
+    return row[end];
+}
+
+};
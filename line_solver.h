@@ -0,0 +1,98 @@
+#ifndef LINE_SOLVER_H
+#define LINE_SOLVER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "arena.h"
+
+namespace nonogram
+{
+
+// Storage for row/col rules
+typedef struct
+{
+    int color_idx;
+    int count;
+} rule_element_t;
+typedef arena_vector<rule_element_t> rule_t;
+
+// Dynamic programming line solver
+//
+// Computes the union of all placements of a rule which are consistent with
+// the current cell bitmasks of a line, without enumerating the placements.
+// Runs in O(length x clues) time, plus O(length x colors) for setup.
+class line_solver
+{
+public:
+
+    // Constructor (scratch space drawn from mem, or the heap for NULL)
+    explicit line_solver(arena *mem = NULL);
+
+    // Filter a line against a rule
+    //
+    // Writes the union of all consistent placements to result, which may
+    // alias cells. Returns false if no placement is consistent.
+    bool solve(rule_t const &rule, uint32_t const *cells, size_t length,
+               uint32_t *result);
+
+    // Mark where a line splits into parts that can be solved separately
+    //
+    // Sets cut[i] (0 < i < length) if every consistent placement puts the
+    // same segments before cell i, with no pad space needed across it, so
+    // cells before and from i on don't constrain each other. Returns false
+    // if no placement is consistent.
+    bool cuts(rule_t const &rule, uint32_t const *cells, size_t length,
+              uint8_t *cut);
+
+private:
+
+    // Find where segments can go, from each end of a line (false if
+    // nowhere)
+    bool reach(rule_t const &rule, uint32_t const *cells, size_t length);
+
+    // Number of cells in [begin, end) which cannot hold segment color
+    int blocked(size_t seg, size_t begin, size_t end) const;
+
+    // Number of cells in [begin, end) which cannot be white (empty)
+    int not_white(size_t begin, size_t end) const;
+
+    // Can segment be placed at start, along with its required pad spaces?
+    bool fits_left(size_t seg, size_t start) const;
+    bool fits_right(size_t seg, size_t start) const;
+
+    // Working copy of the non-empty rule segments
+    arena_vector<uint32_t> seg_mask_;
+    arena_vector<size_t> seg_len_;
+    arena_vector<size_t> seg_slot_;
+    arena_vector<size_t> seg_gap_;
+
+    // Prefix slot assigned to each color table entry
+    arena_vector<int> slot_by_color_;
+
+    // Prefix counts of cells blocked for each color in use (slot 0 is white)
+    arena_vector<int> blocked_;
+
+    // Reachability tables, (segments + 1) x (length + 1)
+    //   fwd_[j][i] - first j segments fit in cells [0, i)
+    //   bwd_[j][i] - segments j and up fit in cells [i, length)
+    arena_vector<uint8_t> fwd_;
+    arena_vector<uint8_t> bwd_;
+
+    // Per-segment coverage difference array
+    arena_vector<int> cover_;
+
+    // Union of colors being collected
+    arena_vector<uint32_t> out_;
+
+    // First start and last end of each segment
+    arena_vector<size_t> first_;
+    arena_vector<size_t> last_;
+
+    // Dimensions of current problem
+    size_t nsegs_;
+    size_t length_;
+};
+
+};
+
+#endif
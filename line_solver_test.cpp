@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "colors.h"
+#include "line_solver.h"
+#include "pattern_set.h"
+using namespace std;
+using namespace nonogram;
+
+// Line to solve: a rule, as (color index, count) pairs, and the cells as
+// color tokens, . for unknown (any color of the rule, or white)
+typedef struct
+{
+    vector<rule_element_t> rule;
+    char const *cells;
+} line_t;
+
+// Lines with edge cases: empty rules, full lines, segments of one color
+// needing a gap and of different colors touching, zero counts, and rules
+// which don't fit at all
+static line_t const fixed_lines[] =
+{
+    { {}, ".........." },
+    { {}, "....K....." },
+    { { { 1, 10 } }, ".........." },
+    { { { 1, 3 }, { 1, 2 } }, "......" },
+    { { { 1, 3 }, { 1, 3 } }, "......." },
+    { { { 1, 3 }, { 1, 3 } }, "......" },
+    { { { 2, 3 }, { 3, 3 } }, "......" },
+    { { { 2, 2 }, { 3, 1 }, { 2, 2 } }, "........" },
+    { { { 1, 0 }, { 1, 4 }, { 1, 0 } }, "......" },
+    { { { 1, 2 }, { 2, 2 }, { 1, 1 } }, ".R......K." },
+    { { { 1, 4 } }, "..K....K.." },
+    { { { 1, 4 } }, "...K.K...." },
+    { { { 2, 1 }, { 3, 1 } }, "G.R......." },
+    { { { 1, 1 } }, "          " },
+    { { { 1, 3 }, { 2, 3 } }, "R........K" },
+};
+
+// All colors a rule uses, and white
+static uint32_t any_color(vector<rule_element_t> const &rule)
+{
+    uint32_t mask = color_table[0].bitmask;
+    for (size_t e = 0; e < rule.size(); e++)
+    {
+        mask |= color_table[rule[e].color_idx].bitmask;
+    }
+    return mask;
+}
+
+// Does the DP solver give the same union of placements (or contradiction)
+// as generating and pruning every placement?
+static bool agree(vector<rule_element_t> const &elements,
+                  vector<uint32_t> const &cells)
+{
+    rule_t rule(elements.begin(), elements.end());
+    size_t length = cells.size();
+
+    pattern_set patterns;
+    pattern_set::scratch_t scratch;
+    patterns.generate(rule, length);
+    vector<uint32_t> ids(patterns.size() + 1);
+    for (size_t k = 0; k < patterns.size(); k++)
+    {
+        ids[k] = k;
+    }
+    size_t live = patterns.prune(&ids[0], patterns.size(), &cells[0],
+                                 scratch);
+    vector<uint32_t> expected(length + 1, 0);
+    if (live > 0)
+    {
+        patterns.reduce(&ids[0], live, &expected[0], scratch);
+    }
+
+    line_solver dp;
+    vector<uint32_t> result(length + 1, 0);
+    bool consistent = dp.solve(rule, &cells[0], length, &result[0]);
+    if (consistent != (live > 0))
+    {
+        return false;
+    }
+    return !consistent || (result == expected);
+}
+
+// Show a line which failed
+static void show(char const *what, vector<rule_element_t> const &rule,
+                 vector<uint32_t> const &cells)
+{
+    printf("FAIL %s rule", what);
+    for (size_t e = 0; e < rule.size(); e++)
+    {
+        printf(" %d%s", rule[e].count, color_table[rule[e].color_idx].token);
+    }
+    printf(", cells");
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        printf(" %x", cells[i]);
+    }
+    printf("\n");
+}
+
+// Check the fixed lines
+static int test_fixed()
+{
+    int failures = 0;
+    for (size_t l = 0; l < sizeof(fixed_lines) / sizeof(fixed_lines[0]);
+         l++)
+    {
+        line_t const &line = fixed_lines[l];
+        vector<uint32_t> cells;
+        for (char const *c = line.cells; *c; c++)
+        {
+            int idx;
+            if (*c == '.')
+            {
+                cells.push_back(any_color(line.rule));
+            }
+            else if (*c == ' ')
+            {
+                cells.push_back(color_table[0].bitmask);
+            }
+            else if (color_table_lookup(c, 1, idx))
+            {
+                cells.push_back(color_table[idx].bitmask);
+            }
+        }
+        if (!agree(line.rule, cells))
+        {
+            show("fixed", line.rule, cells);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// Check random lines: the rule of a random line of up to three colors,
+// against cells partly narrowed, to colors of that line (so the rule
+// still fits) or at random (so it may not)
+static int test_random()
+{
+    static int const colors[] = { 1, 2, 3 };
+    int failures = 0;
+    mt19937 random(1);
+    for (size_t run = 0; run < 2000; run++)
+    {
+        size_t length = 1 + random() % 24;
+        size_t ncolors = 1 + random() % 3;
+        vector<int> board(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            board[i] = (random() % 2) ? colors[random() % ncolors] : 0;
+        }
+
+        vector<rule_element_t> rule;
+        for (size_t i = 0; i < length; i++)
+        {
+            if ((board[i] > 0) && (i > 0) && (board[i] == board[i - 1]))
+            {
+                rule.back().count++;
+            }
+            else if (board[i] > 0)
+            {
+                rule_element_t element = { board[i], 1 };
+                rule.push_back(element);
+            }
+        }
+
+        bool fits = (run % 2 == 0);
+        uint32_t any = any_color(rule);
+        vector<uint32_t> cells(length, any);
+        for (size_t i = 0; i < length; i++)
+        {
+            unsigned pick = random() % 4;
+            if ((pick == 0) && fits)
+            {
+                cells[i] = color_table[board[i]].bitmask;
+            }
+            else if ((pick == 0) && !fits)
+            {
+                cells[i] = color_table[random() % (ncolors + 1)].bitmask;
+            }
+            else if (pick == 1)
+            {
+                cells[i] = (any & ~color_table[random() % 4].bitmask) |
+                           color_table[board[i]].bitmask;
+            }
+        }
+
+        if (!agree(rule, cells))
+        {
+            show("random", rule, cells);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// Compare the DP line solver with the pattern engine, on edge cases and
+// random lines
+int main()
+{
+    int failures = test_fixed() + test_random();
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -1,35 +1,278 @@
+#include <atomic>
+#include <climits>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include "solver.h"
+#include "tools.h"
 using namespace std;
 using namespace nonogram;
 
+// Set on Ctrl-C, to stop solving and show how far it got
+static atomic<bool> interrupted(false);
+
+// Note Ctrl-C
+static void on_interrupt(int)
+{
+    interrupted = true;
+}
+
+// Show command line usage
+static void usage(char const *name)
+{
+    cerr << "Usage: " << name << " [-e patterns|dp] [-b first|fewest|cells]"
+         << " [-p seconds] [-w] [-s limit] [-d seconds] [-g guesses]"
+         << " [-P file] [-q|-n] [-j threads] <puzzle.in|puzzle.nonb>"
+         << endl;
+    cerr << "  -e  Line solving engine (default patterns)" << endl;
+    cerr << "  -b  Branching strategy for guesses (default first)" << endl;
+    cerr << "  -p  Time to spend probing cells before each guess (default 0,"
+         << " none)" << endl;
+    cerr << "  -w  Search the whole puzzle as one, without splitting off"
+         << " independent parts" << endl;
+    cerr << "  -s  Count solutions up to limit, 2 to check one is unique"
+         << " (default 1)" << endl;
+    cerr << "  -d  Seconds allowed before stopping (default 0, no"
+         << " limit)" << endl;
+    cerr << "  -g  Guesses allowed before stopping (default 0, no"
+         << " limit)" << endl;
+    cerr << "  -P  Write time in each stage, and counters, as JSON to file"
+         << " (- for stdout)" << endl;
+    cerr << "  -q  Headless, show only final board and timing" << endl;
+    cerr << "  -n  Headless, show only status and timing" << endl;
+    cerr << "  -j  Worker threads for guessing (default 0, serial)" << endl;
+    exit(1);
+}
+
 int main(int argc, char **argv)
 {
+    engine_t engine = ENGINE_PATTERNS;
+    branch_t branching = BRANCH_FIRST;
+    double probe_seconds = 0;
+    bool decompose = true;
+    size_t solution_limit = 1;
+    limits_t limits = { 0, 0, NULL };
+    char const *profile_file = NULL;
+    bool interactive = true;
+    bool show_final = true;
+    unsigned nthreads = 0;
+    char const *filename = NULL;
+    unsigned long number;
+
+    // Parse command line
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-e") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!engine_named(argv[i], engine))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!branching_named(argv[i], branching))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            probe_seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            decompose = false;
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 1, ULONG_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            solution_limit = number;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            limits.seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, ULONG_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            limits.guesses = number;
+        }
+        else if (strcmp(argv[i], "-P") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            profile_file = argv[i];
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, max_threads, number))
+            {
+                usage(argv[0]);
+            }
+            nthreads = number;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            interactive = false;
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            interactive = false;
+            show_final = false;
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+
     // Sanity check
-    if (argc < 2)
+    if (filename == NULL)
     {
         cerr << "No input file specified" << endl;
-        exit(1);
+        usage(argv[0]);
     }
 
-    solver app(argv[1]);
-
     try
     {
-        if (app.run())
+        solver app;
+        app.set_branching(branching);
+        app.set_probing(probe_seconds);
+        app.set_decomposition(decompose);
+        app.set_solution_limit(solution_limit);
+        limits.cancel = &interrupted;
+        app.set_limits(limits);
+        signal(SIGINT, on_interrupt);
+        app.load(filename, engine);
+
+        // Step through interactively?
+        stepper step;
+        if (interactive)
+        {
+            app.set_observer(&step);
+        }
+
+        // Guess in parallel?
+        task_pool pool(nthreads);
+        if (nthreads > 0)
+        {
+            app.set_pool(&pool);
+        }
+
+        result_t result = app.solve();
+
+        // Show final board, and a second solution if counting found one
+        if (!interactive && show_final)
+        {
+            app.show_board();
+            if (app.solution(1))
+            {
+                cout << endl;
+                app.show_solution(1);
+            }
+        }
+
+        if (!result.solved && (result.status == STATUS_TIMEOUT))
+        {
+            printf("Stopped early, %.1f%% solved", result.complete);
+        }
+        else if (result.solved && (solution_limit > 1))
+        {
+            if (result.solutions == 1)
+            {
+                cout << "Unique solution found";
+            }
+            else
+            {
+                cout << result.solutions << " solutions found";
+                if (result.solutions >= solution_limit)
+                {
+                    cout << " (limit reached)";
+                }
+            }
+        }
+        else if (result.solved)
         {
-            cout << "Solution found" << endl;
+            cout << "Solution found";
         }
         else
         {
-            cout << "No solution found" << endl;
+            cout << "No solution found";
+        }
+        if (result.solved && (result.status == STATUS_TIMEOUT))
+        {
+            cout << " (stopped early)";
+        }
+        if (!interactive)
+        {
+            printf(" (%.3f ms)", result.seconds * 1000.);
+        }
+        cout << endl;
+
+        // Write profile
+        if (profile_file && (strcmp(profile_file, "-") == 0))
+        {
+            cout << app.profiling().json() << endl;
+        }
+        else if (profile_file)
+        {
+            ofstream ofile(profile_file);
+            ofile << app.profiling().json() << endl;
+            if (!ofile.good())
+            {
+                cerr << "Cannot write profile " << profile_file << endl;
+            }
         }
+
+        if (result.status == STATUS_TIMEOUT)
+        {
+            return 2;
+        }
+        return result.solved ? 0 : 1;
     }
     catch (exception &e)
     {
         cerr << "Caught an exception: " << e.what() << endl;
+        return 1;
     }
-
-    return 0;
 }
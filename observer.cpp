@@ -0,0 +1,28 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include "observer.h"
+#include "solver.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Show progress and wait for user
+void stepper::progress(solver &app)
+{
+    // Visualize board
+    app.show_board();
+
+    // Track number of patterns in memory
+    printf("Tracking %lu row/col patterns\n", app.pattern_count());
+
+    // Show progress
+    printf("%.2f%% complete\n", app.percent_complete());
+
+    // Wait for user to hit enter
+    string foo;
+    getline(cin, foo);
+}
+
+};
@@ -0,0 +1,31 @@
+#ifndef OBSERVER_H
+#define OBSERVER_H
+
+namespace nonogram
+{
+
+class solver;
+
+// Solver progress observer
+class observer
+{
+public:
+
+    // Destructor
+    virtual ~observer() {}
+
+    // Called after each line which solves more cells
+    virtual void progress(solver &app) = 0;
+};
+
+// Interactive stepping (show board, wait for user to hit enter)
+class stepper : public observer
+{
+public:
+
+    void progress(solver &app);
+};
+
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "packed_patterns.h"
+#include "colors.h"
+#include "kernels.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Constructor (storage drawn from mem, or the heap for NULL)
+packed_patterns::packed_patterns(arena *mem)
+    : white_(0), black_(0), length_(0), words_(0), count_(0), bits_(mem)
+{
+}
+
+// Working space for checks and unions
+packed_patterns::scratch_t::scratch_t(arena *mem)
+    : filled(mem), empty(mem), keep(mem), culled(mem)
+{
+}
+
+// Pack a set of patterns (white or black only)
+void packed_patterns::assign(pattern_set const &patterns, size_t length)
+{
+    white_ = color_table[0].bitmask;
+    black_ = color_table[1].bitmask;
+    length_ = length;
+    words_ = (length + 63) / 64;
+    count_ = patterns.size();
+    bits_.assign(count_ * words_, 0);
+    arena_vector<uint32_t> cells(length);
+
+    for (size_t id = 0; id < count_; id++)
+    {
+        uint64_t *cur = pattern(id);
+        patterns.unpack(id, &cells[0]);
+        for (size_t i = 0; i < length; i++)
+        {
+            if (cells[i] == black_)
+            {
+                cur[i / 64] |= (uint64_t)1 << (i % 64);
+            }
+        }
+    }
+}
+
+// Take count patterns of rule packed earlier instead of packing them
+bool packed_patterns::assign(rule_t const &rule, size_t length,
+                             void const *bits, size_t count, size_t bytes)
+{
+    white_ = color_table[0].bitmask;
+    black_ = color_table[1].bitmask;
+    length_ = length;
+    words_ = (length + 63) / 64;
+    count_ = 0;
+    bits_.clear();
+    if ((bytes != count * words_ * sizeof(uint64_t)) ||
+        (count != pattern_set::placements(rule, length, count)))
+    {
+        return false;
+    }
+
+    // Nothing may be filled past the end of the line
+    uint64_t const *words = (uint64_t const *)bits;
+    uint64_t beyond = (length % 64) ? ~(uint64_t)0 << (length % 64) : 0;
+    for (size_t id = 0; id < count; id++)
+    {
+        if (words[(id + 1) * words_ - 1] & beyond)
+        {
+            return false;
+        }
+    }
+    bits_.assign(words, words + count * words_);
+
+    // Each pattern must place the rule, later in the order generated than
+    // the one before, so none repeats in place of another
+    arena_vector<size_t> prev;
+    arena_vector<size_t> starts;
+    for (size_t id = 0; id < count; id++)
+    {
+        if (!runs(id, rule, starts) || ((id > 0) && !(prev < starts)))
+        {
+            bits_.clear();
+            return false;
+        }
+        prev.swap(starts);
+    }
+    count_ = count;
+    return true;
+}
+
+// Approximate memory used
+size_t packed_patterns::bytes() const
+{
+    return sizeof(*this) + bits_.capacity() * sizeof(uint64_t);
+}
+
+// Discard ids of patterns no longer matching cells
+size_t packed_patterns::prune(uint32_t *ids, size_t live,
+                              uint32_t const *cells, scratch_t &scratch) const
+{
+    // Those with a filled cell where the board is empty, or the other way
+    // round, move past the end of the live range
+    split_planes(cells, scratch);
+    scratch.keep.resize(live);
+    scratch.culled.resize(live);
+    kernels_t const *kern = best_kernels();
+    kern->and_nonzero(bits_.data(), words_, ids, live, scratch.filled.data(),
+                      scratch.empty.data(), scratch.keep.data());
+    return kern->compact(ids, scratch.keep.data(), live,
+                         scratch.culled.data());
+}
+
+// Union of colors over live patterns, as cell bitmasks
+void packed_patterns::reduce(uint32_t const *ids, size_t live,
+                             uint32_t *result, scratch_t &scratch) const
+{
+    // Collect which cells may be filled, and which may be empty
+    arena_vector<uint64_t> &can_fill = scratch.filled;
+    arena_vector<uint64_t> &can_empty = scratch.empty;
+    can_fill.assign(words_, 0);
+    can_empty.assign(words_, 0);
+    best_kernels()->or_words(bits_.data(), words_, ids, live, can_fill.data(),
+                             can_empty.data());
+
+    // Expand back to bitmasks
+    for (size_t i = 0; i < length_; i++)
+    {
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        result[i] = ((can_fill[i / 64] & bit) ? black_ : 0) |
+                    ((can_empty[i / 64] & bit) ? white_ : 0);
+    }
+}
+
+// Number of live patterns giving each cell each color
+void packed_patterns::count(uint32_t const *ids, size_t live,
+                            uint32_t *counts) const
+{
+    size_t ncolors = color_table_size;
+    for (size_t i = 0; i < length_ * ncolors; i++)
+    {
+        counts[i] = 0;
+    }
+    for (size_t i = 0; i < length_; i++)
+    {
+        counts[i * ncolors] = live;
+    }
+    for (size_t k = 0; k < live; k++)
+    {
+        uint64_t const *cur = pattern(ids[k]);
+        for (size_t i = 0; i < length_; i++)
+        {
+            if (cur[i / 64] & ((uint64_t)1 << (i % 64)))
+            {
+                counts[i * ncolors + 1]++;
+                counts[i * ncolors]--;
+            }
+        }
+    }
+}
+
+// Expand a pattern back to cell bitmasks (length cells)
+void packed_patterns::unpack(size_t id, uint32_t *out) const
+{
+    uint64_t const *cur = pattern(id);
+    for (size_t i = 0; i < length_; i++)
+    {
+        out[i] = (cur[i / 64] & ((uint64_t)1 << (i % 64))) ? black_ : white_;
+    }
+}
+
+// Start of each filled run of a pattern, if they place rule
+bool packed_patterns::runs(size_t id, rule_t const &rule,
+                           arena_vector<size_t> &starts) const
+{
+    uint64_t const *cur = pattern(id);
+    size_t seg = 0;
+    starts.clear();
+    for (size_t i = 0; i < length_; )
+    {
+        if ((cur[i / 64] & ((uint64_t)1 << (i % 64))) == 0)
+        {
+            i++;
+            continue;
+        }
+
+        // Measure the run, and match it to the next rule segment
+        size_t start = i;
+        while ((i < length_) && (cur[i / 64] & ((uint64_t)1 << (i % 64))))
+        {
+            i++;
+        }
+        while ((seg < rule.size()) && (rule[seg].count <= 0))
+        {
+            seg++;
+        }
+        if ((seg == rule.size()) || ((size_t)rule[seg].count != i - start))
+        {
+            return false;
+        }
+        starts.push_back(start);
+        seg++;
+    }
+
+    // No segments left over
+    while ((seg < rule.size()) && (rule[seg].count <= 0))
+    {
+        seg++;
+    }
+    return (seg == rule.size());
+}
+
+// Split cells into must fill / must be empty planes
+void packed_patterns::split_planes(uint32_t const *cells,
+                                   scratch_t &scratch) const
+{
+    arena_vector<uint64_t> &filled = scratch.filled;
+    arena_vector<uint64_t> &empty = scratch.empty;
+    filled.assign(words_, 0);
+    empty.assign(words_, 0);
+    for (size_t i = 0; i < length_; i++)
+    {
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        if ((cells[i] & black_) == 0)
+        {
+            empty[i / 64] |= bit;
+        }
+        else if ((cells[i] & white_) == 0)
+        {
+            filled[i / 64] |= bit;
+        }
+    }
+}
+
+};
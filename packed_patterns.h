@@ -0,0 +1,108 @@
+#ifndef PACKED_PATTERNS_H
+#define PACKED_PATTERNS_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "arena.h"
+#include "pattern_set.h"
+
+namespace nonogram
+{
+
+// Line patterns for black and white puzzles
+//
+// Each pattern is packed one bit per cell (set for filled), in one buffer
+// per line, so consistency checks and unions run 64 cells at a time. Board
+// cells are split into two planes, cells which must be filled and cells
+// which must be empty, once per check.
+//
+// As with pattern_set, the packed patterns are read only once built, and
+// each line tracks the ids of the patterns it still allows.
+class packed_patterns
+{
+public:
+
+    // Working space for checks and unions (one per user, as for
+    // pattern_set)
+    struct scratch_t
+    {
+        explicit scratch_t(arena *mem = NULL);
+
+        // Cells which must be filled / empty, or may be filled / empty
+        arena_vector<uint64_t> filled;
+        arena_vector<uint64_t> empty;
+
+        // Keep flag of each live pattern, and ids culled, while pruning
+        arena_vector<uint32_t> keep;
+        arena_vector<uint32_t> culled;
+    };
+
+    // Constructor (storage drawn from mem, or the heap for NULL)
+    explicit packed_patterns(arena *mem = NULL);
+
+    // Pack a set of patterns (white or black only)
+    void assign(pattern_set const &patterns, size_t length);
+
+    // Take count patterns of rule packed earlier (bytes of pattern bits, as
+    // from bits()) instead of packing them. False unless they are all
+    // placements of the rule in a line of length cells, in the order
+    // generated.
+    bool assign(rule_t const &rule, size_t length, void const *bits,
+                size_t count, size_t bytes);
+
+    // Pattern bits, and their size in bytes
+    void const *bits() const { return bits_.data(); }
+    size_t bit_bytes() const { return bits_.size() * sizeof(uint64_t); }
+
+    // Number of patterns stored
+    size_t size() const { return count_; }
+
+    // Approximate memory used
+    size_t bytes() const;
+
+    // Discard ids of patterns no longer matching cells, by moving them
+    // past the end of the live range (both ranges keep their order).
+    // Returns new live count.
+    size_t prune(uint32_t *ids, size_t live, uint32_t const *cells,
+                 scratch_t &scratch) const;
+
+    // Union of colors over live patterns, as cell bitmasks
+    void reduce(uint32_t const *ids, size_t live, uint32_t *result,
+                scratch_t &scratch) const;
+
+    // Number of live patterns giving each cell each color, as
+    // counts[cell * color_table_size + color index]
+    void count(uint32_t const *ids, size_t live, uint32_t *counts) const;
+
+    // Expand a pattern back to cell bitmasks (length cells)
+    void unpack(size_t id, uint32_t *pattern) const;
+
+private:
+
+    // Start of each filled run of a pattern, if they place rule
+    bool runs(size_t id, rule_t const &rule,
+              arena_vector<size_t> &starts) const;
+
+    // Split cells into must fill / must be empty planes
+    void split_planes(uint32_t const *cells, scratch_t &scratch) const;
+
+    // Pointer to first word of a pattern
+    uint64_t *pattern(size_t id) { return &bits_[id * words_]; }
+    uint64_t const *pattern(size_t id) const { return &bits_[id * words_]; }
+
+    // Cell bitmasks for the two colors in play
+    uint32_t white_;
+    uint32_t black_;
+
+    // Dimensions
+    size_t length_;
+    size_t words_;
+    size_t count_;
+
+    // Packed patterns, words_ per pattern
+    arena_vector<uint64_t> bits_;
+};
+
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "pattern_cache.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Constructor
+pattern_cache::pattern_cache(size_t max_bytes)
+    : max_bytes_(max_bytes), bytes_(0), hits_(0), misses_(0)
+{
+}
+
+// All placements of rule in a line of length cells
+shared_ptr<pattern_set const> pattern_cache::patterns(
+    rule_t const &rule, size_t length, function<bool()> const *stop)
+{
+    return lookup(rule, length, false, stop).patterns;
+}
+
+// Same, packed a bit per cell (black and white rules only)
+shared_ptr<packed_patterns const> pattern_cache::packed(
+    rule_t const &rule, size_t length, function<bool()> const *stop)
+{
+    return lookup(rule, length, true, stop).packed;
+}
+
+// Change memory cap, dropping sets as needed
+void pattern_cache::set_max_bytes(size_t max_bytes)
+{
+    lock_guard<mutex> guard(lock_);
+    max_bytes_ = max_bytes;
+    evict();
+}
+
+// Lookups answered from the cache
+unsigned long pattern_cache::hits() const
+{
+    lock_guard<mutex> guard(lock_);
+    return hits_;
+}
+
+// Sets generated
+unsigned long pattern_cache::misses() const
+{
+    lock_guard<mutex> guard(lock_);
+    return misses_;
+}
+
+// Approximate memory held by cached sets
+size_t pattern_cache::bytes() const
+{
+    lock_guard<mutex> guard(lock_);
+    return bytes_;
+}
+
+// Find sets for a rule, generating them if needed
+pattern_cache::sets_t pattern_cache::lookup(rule_t const &rule, size_t length,
+                                            bool packed,
+                                            function<bool()> const *stop)
+{
+    size_t hash = hash_key(rule, length, packed);
+    sets_t sets;
+    {
+        lock_guard<mutex> guard(lock_);
+        if (find(rule, length, packed, hash, sets))
+        {
+            hits_++;
+            return sets;
+        }
+        misses_++;
+    }
+
+    // Generate without holding up other lookups
+    entry_t fresh = new_entry(rule, length, packed, hash);
+    pattern_set *generated = new pattern_set;
+    fresh.sets.patterns.reset(generated);
+    if (!generated->generate(rule, length, stop))
+    {
+        return sets_t();
+    }
+    fresh.bytes = generated->bytes();
+    if (packed)
+    {
+        packed_patterns *bits = new packed_patterns;
+        bits->assign(*generated, length);
+        fresh.sets.packed.reset(bits);
+        fresh.sets.patterns.reset();
+        fresh.bytes = bits->bytes();
+    }
+    return insert(rule, length, packed, fresh);
+}
+
+// Add patterns made earlier for rule, unless already cached
+bool pattern_cache::adopt(rule_t const &rule, size_t length, bool packed,
+                          void const *data, size_t count, size_t bytes)
+{
+    size_t hash = hash_key(rule, length, packed);
+    sets_t sets;
+    {
+        lock_guard<mutex> guard(lock_);
+        if (find(rule, length, packed, hash, sets))
+        {
+            return true;
+        }
+    }
+
+    entry_t fresh = new_entry(rule, length, packed, hash);
+    if (packed)
+    {
+        packed_patterns *bits = new packed_patterns;
+        fresh.sets.packed.reset(bits);
+        if (!bits->assign(rule, length, data, count, bytes))
+        {
+            return false;
+        }
+        fresh.bytes = bits->bytes();
+    }
+    else
+    {
+        pattern_set *patterns = new pattern_set;
+        fresh.sets.patterns.reset(patterns);
+        if (!patterns->assign(rule, length, data, count, bytes))
+        {
+            return false;
+        }
+        fresh.bytes = patterns->bytes();
+    }
+    insert(rule, length, packed, fresh);
+    return true;
+}
+
+// Start an entry for a rule, with no sets yet
+pattern_cache::entry_t pattern_cache::new_entry(rule_t const &rule,
+                                                size_t length, bool packed,
+                                                size_t hash)
+{
+    entry_t fresh;
+    fresh.hash = hash;
+    fresh.bytes = 0;
+    fresh.key.push_back(length);
+    fresh.key.push_back(packed);
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (rule[i].count > 0)
+        {
+            fresh.key.push_back(rule[i].color_idx);
+            fresh.key.push_back(rule[i].count);
+        }
+    }
+    return fresh;
+}
+
+// Add a new entry, unless another thread beat us to it
+pattern_cache::sets_t pattern_cache::insert(rule_t const &rule, size_t length,
+                                            bool packed, entry_t const &fresh)
+{
+    sets_t sets;
+    lock_guard<mutex> guard(lock_);
+    if (find(rule, length, packed, fresh.hash, sets))
+    {
+        return sets;
+    }
+    lru_.push_front(fresh);
+    index_.insert(make_pair(fresh.hash, lru_.begin()));
+    bytes_ += fresh.bytes;
+    evict();
+    return fresh.sets;
+}
+
+// Find an entry, and move it to the front (lock held)
+bool pattern_cache::find(rule_t const &rule, size_t length, bool packed,
+                         size_t hash, sets_t &sets)
+{
+    auto range = index_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        lru_t::iterator entry = it->second;
+        if (key_matches(entry->key, rule, length, packed))
+        {
+            lru_.splice(lru_.begin(), lru_, entry);
+            sets = entry->sets;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drop least recently used entries until under cap (lock held)
+void pattern_cache::evict()
+{
+    while ((bytes_ > max_bytes_) && !lru_.empty())
+    {
+        lru_t::iterator last = --lru_.end();
+        auto range = index_.equal_range(last->hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == last)
+            {
+                index_.erase(it);
+                break;
+            }
+        }
+        bytes_ -= last->bytes;
+        lru_.erase(last);
+    }
+}
+
+// Hash a key without building it
+size_t pattern_cache::hash_key(rule_t const &rule, size_t length, bool packed)
+{
+    size_t hash = (length * 2) + packed;
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (rule[i].count > 0)
+        {
+            hash = (hash * 1000003) ^ rule[i].color_idx;
+            hash = (hash * 1000003) ^ rule[i].count;
+        }
+    }
+    return hash;
+}
+
+// Does an entry key match?
+bool pattern_cache::key_matches(vector<int> const &key, rule_t const &rule,
+                                size_t length, bool packed)
+{
+    if ((key[0] != (int)length) || (key[1] != (int)packed))
+    {
+        return false;
+    }
+
+    size_t k = 2;
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (rule[i].count > 0)
+        {
+            if ((k + 2 > key.size()) || (key[k] != rule[i].color_idx) ||
+                (key[k + 1] != rule[i].count))
+            {
+                return false;
+            }
+            k += 2;
+        }
+    }
+    return (k == key.size());
+}
+
+};
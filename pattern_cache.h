@@ -0,0 +1,128 @@
+#ifndef PATTERN_CACHE_H
+#define PATTERN_CACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "line_solver.h"
+#include "packed_patterns.h"
+#include "pattern_set.h"
+
+namespace nonogram
+{
+
+// Pattern sets shared by every line with the same rule and length
+//
+// Sets are generated on first use and handed out read only, so any number
+// of lines, puzzles and threads can share them. Once the cache grows past
+// its memory cap, the least recently used sets are dropped (lines still
+// using a dropped set keep it alive until they are done with it).
+class pattern_cache
+{
+public:
+
+    // Default memory cap
+    static size_t const default_max_bytes = 64 << 20;
+
+    // Constructor
+    explicit pattern_cache(size_t max_bytes = default_max_bytes);
+
+    // All placements of rule in a line of length cells. If they have to
+    // be generated, stop (if given) is asked now and then whether to give
+    // up, and NULL is returned if it did.
+    std::shared_ptr<pattern_set const> patterns(
+        rule_t const &rule, size_t length,
+        std::function<bool()> const *stop = NULL);
+
+    // Same, packed a bit per cell (black and white rules only)
+    std::shared_ptr<packed_patterns const> packed(
+        rule_t const &rule, size_t length,
+        std::function<bool()> const *stop = NULL);
+
+    // Add patterns made earlier for rule (count of them, as bytes of
+    // packed offsets, or of pattern bits if packed), unless already cached.
+    // False unless they are exactly the sets generating would give.
+    bool adopt(rule_t const &rule, size_t length, bool packed,
+               void const *data, size_t count, size_t bytes);
+
+    // Change memory cap, dropping sets as needed
+    void set_max_bytes(size_t max_bytes);
+
+    // Lookups answered from the cache, and sets generated
+    unsigned long hits() const;
+    unsigned long misses() const;
+
+    // Approximate memory held by cached sets
+    size_t bytes() const;
+
+private:
+
+    // Cached sets (one of the two, depending on packing)
+    typedef struct
+    {
+        std::shared_ptr<pattern_set const> patterns;
+        std::shared_ptr<packed_patterns const> packed;
+    } sets_t;
+
+    // Cache entry, keyed by line length, packing, then the (color, count)
+    // of each non-empty rule segment
+    typedef struct
+    {
+        std::vector<int> key;
+        size_t hash;
+        size_t bytes;
+        sets_t sets;
+    } entry_t;
+
+    // Entries, most recently used first
+    typedef std::list<entry_t> lru_t;
+
+    // Find sets for a rule, generating them if needed (none if stop gave
+    // up)
+    sets_t lookup(rule_t const &rule, size_t length, bool packed,
+                  std::function<bool()> const *stop);
+
+    // Start an entry for a rule, with no sets yet
+    static entry_t new_entry(rule_t const &rule, size_t length, bool packed,
+                             size_t hash);
+
+    // Add a new entry, unless another thread beat us to it (returns the
+    // sets cached)
+    sets_t insert(rule_t const &rule, size_t length, bool packed,
+                  entry_t const &fresh);
+
+    // Find an entry, and move it to the front (lock held)
+    bool find(rule_t const &rule, size_t length, bool packed, size_t hash,
+              sets_t &sets);
+
+    // Drop least recently used entries until under cap (lock held)
+    void evict();
+
+    // Hash a key without building it
+    static size_t hash_key(rule_t const &rule, size_t length, bool packed);
+
+    // Does an entry key match?
+    static bool key_matches(std::vector<int> const &key, rule_t const &rule,
+                            size_t length, bool packed);
+
+    // Entries, and index by key hash
+    mutable std::mutex lock_;
+    lru_t lru_;
+    std::unordered_multimap<size_t, lru_t::iterator> index_;
+
+    // Memory cap and use
+    size_t max_bytes_;
+    size_t bytes_;
+
+    // Statistics
+    unsigned long hits_;
+    unsigned long misses_;
+};
+
+};
+
+#endif
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include "pattern_set.h"
+#include "colors.h"
+#include "kernels.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Constructor (storage drawn from mem, or the heap for NULL)
+pattern_set::pattern_set(arena *mem)
+    : seg_mask_(mem), seg_color_(mem), seg_len_(mem), seg_slot_(mem),
+      seg_gap_(mem), seg_tail_(mem), slot_mask_(mem), slot_by_color_(mem),
+      length_(0),
+      nsegs_(0), count_(0), wide_(false), narrow_offsets_(mem),
+      wide_offsets_(mem), current_(mem), stop_(NULL), stopped_(false)
+{
+}
+
+// Working space for checks and unions
+pattern_set::scratch_t::scratch_t(arena *mem)
+    : blocked(mem), seen(mem), gaps(mem), keep(mem), culled(mem)
+{
+}
+
+// Generate all placements of rule in a line of length cells
+bool pattern_set::generate(rule_t const &rule, size_t length,
+                           function<bool()> const *stop)
+{
+    set_rule(rule, length);
+
+    // Place everything, left-most placements first
+    current_.resize(nsegs_);
+    stop_ = stop;
+    stopped_ = false;
+    if (seg_tail_[0] <= length)
+    {
+        place(0, 0);
+    }
+    stop_ = NULL;
+
+    // Drop what was placed before giving up
+    if (stopped_)
+    {
+        set_rule(rule, length);
+        return false;
+    }
+    return true;
+}
+
+// Take placements made earlier instead of generating them
+bool pattern_set::assign(rule_t const &rule, size_t length,
+                         void const *offsets, size_t count, size_t bytes)
+{
+    set_rule(rule, length);
+    size_t width = wide_ ? sizeof(uint16_t) : sizeof(uint8_t);
+    if ((bytes != count * nsegs_ * width) ||
+        (count != placements(rule, length, count)))
+    {
+        return false;
+    }
+
+    // Offsets out of place would send checks outside the line, and
+    // patterns out of order could repeat one in place of another
+    if (wide_)
+    {
+        uint16_t const *wide = (uint16_t const *)offsets;
+        if (!check_offsets(wide, count))
+        {
+            return false;
+        }
+        wide_offsets_.assign(wide, wide + count * nsegs_);
+    }
+    else
+    {
+        uint8_t const *narrow = (uint8_t const *)offsets;
+        if (!check_offsets(narrow, count))
+        {
+            return false;
+        }
+        narrow_offsets_.assign(narrow, narrow + count * nsegs_);
+    }
+    count_ = count;
+    return true;
+}
+
+// Number of placements of rule in a line of length cells
+size_t pattern_set::placements(rule_t const &rule, size_t length,
+                               size_t limit)
+{
+    // Fewest cells the rule needs
+    size_t nsegs = 0;
+    size_t needed = 0;
+    int prev = -1;
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (rule[i].count > 0)
+        {
+            needed += rule[i].count + (rule[i].color_idx == prev);
+            prev = rule[i].color_idx;
+            nsegs++;
+        }
+    }
+    if (needed > length)
+    {
+        return 0;
+    }
+
+    // Ways to share out the spare cells before and after segments,
+    // C(spare + nsegs, nsegs), built up so each step is a whole count
+    size_t spare = length - needed;
+    size_t ways = 1;
+    for (size_t k = 1; k <= nsegs; k++)
+    {
+        if (ways > SIZE_MAX / (spare + k))
+        {
+            return limit + 1;
+        }
+        ways = ways * (spare + k) / k;
+        if (ways > limit)
+        {
+            return limit + 1;
+        }
+    }
+    return ways;
+}
+
+// Packed offsets
+void const *pattern_set::offsets() const
+{
+    if (wide_)
+    {
+        return wide_offsets_.data();
+    }
+    return narrow_offsets_.data();
+}
+
+// Size of packed offsets in bytes
+size_t pattern_set::offset_bytes() const
+{
+    return wide_offsets_.size() * sizeof(uint16_t) + narrow_offsets_.size();
+}
+
+// Set up segments for rule in a line of length cells, with no patterns
+void pattern_set::set_rule(rule_t const &rule, size_t length)
+{
+    length_ = length;
+    wide_ = (length > 255);
+    count_ = 0;
+    narrow_offsets_.clear();
+    wide_offsets_.clear();
+
+    // Collect non-empty segments, and assign each color a prefix slot
+    slot_by_color_.assign(color_table_size, -1);
+    slot_by_color_[0] = 0;
+    slot_mask_.assign(1, color_table[0].bitmask);
+    seg_mask_.clear();
+    seg_color_.clear();
+    seg_len_.clear();
+    seg_slot_.clear();
+    seg_gap_.clear();
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (rule[i].count <= 0)
+        {
+            continue;
+        }
+
+        int color = rule[i].color_idx;
+        if (slot_by_color_[color] < 0)
+        {
+            slot_by_color_[color] = slot_mask_.size();
+            slot_mask_.push_back(color_table[color].bitmask);
+        }
+
+        // Ensure at least one pad space between same color segments
+        size_t gap = 0;
+        if (seg_mask_.size() && (seg_mask_.back() == color_table[color].bitmask))
+        {
+            gap = 1;
+        }
+
+        seg_mask_.push_back(color_table[color].bitmask);
+        seg_color_.push_back(color);
+        seg_len_.push_back(rule[i].count);
+        seg_slot_.push_back(slot_by_color_[color]);
+        seg_gap_.push_back(gap);
+    }
+    nsegs_ = seg_mask_.size();
+
+    // Room needed by each tail of the rule
+    seg_tail_.assign(nsegs_ + 1, 0);
+    for (size_t j = nsegs_; j-- > 0; )
+    {
+        seg_tail_[j] = seg_len_[j] + seg_tail_[j + 1];
+        if (j + 1 < nsegs_)
+        {
+            seg_tail_[j] += seg_gap_[j + 1];
+        }
+    }
+}
+
+// Do count patterns of packed offsets each fit the rule?
+template <typename offset_t>
+bool pattern_set::check_offsets(offset_t const *offsets, size_t count) const
+{
+    for (size_t id = 0; id < count; id++)
+    {
+        offset_t const *cur = offsets + id * nsegs_;
+        if ((id > 0) &&
+            !lexicographical_compare(cur - nsegs_, cur, cur, cur + nsegs_))
+        {
+            return false;
+        }
+        size_t start = 0;
+        for (size_t j = 0; j < nsegs_; j++)
+        {
+            if (j > 0)
+            {
+                start += seg_gap_[j];
+            }
+            if ((cur[j] < start) || (cur[j] + seg_tail_[j] > length_))
+            {
+                return false;
+            }
+            start = cur[j] + seg_len_[j];
+        }
+    }
+    return true;
+}
+
+// Approximate memory used
+size_t pattern_set::bytes() const
+{
+    return sizeof(*this) + narrow_offsets_.capacity() +
+           wide_offsets_.capacity() * sizeof(uint16_t) +
+           seg_mask_.capacity() * sizeof(uint32_t) +
+           (seg_color_.capacity() + seg_len_.capacity() +
+            seg_slot_.capacity() + seg_gap_.capacity() + seg_tail_.capacity() +
+            current_.capacity()) * sizeof(size_t) +
+           slot_mask_.capacity() * sizeof(uint32_t) +
+           slot_by_color_.capacity() * sizeof(int);
+}
+
+// Recursively place segment seg and up, starting no earlier than start
+void pattern_set::place(size_t seg, size_t start)
+{
+    // All placed?
+    if (seg == nsegs_)
+    {
+        for (size_t j = 0; j < nsegs_; j++)
+        {
+            if (wide_)
+            {
+                wide_offsets_.push_back(current_[j]);
+            }
+            else
+            {
+                narrow_offsets_.push_back(current_[j]);
+            }
+        }
+        count_++;
+        if (stop_ && (count_ % stop_check_interval == 0) && (*stop_)())
+        {
+            stopped_ = true;
+        }
+        return;
+    }
+
+    // Every start which leaves room for the rest of the rule
+    if (seg > 0)
+    {
+        start += seg_gap_[seg];
+    }
+    for (size_t s = start; (s + seg_tail_[seg] <= length_) && !stopped_; s++)
+    {
+        current_[seg] = s;
+        place(seg + 1, s + seg_len_[seg]);
+    }
+}
+
+// Discard ids of patterns no longer matching cells
+size_t pattern_set::prune(uint32_t *ids, size_t live, uint32_t const *cells,
+                          scratch_t &scratch) const
+{
+    if (live == 0)
+    {
+        return 0;
+    }
+
+    count_blocked(cells, scratch);
+    if (wide_)
+    {
+        return prune_offsets<uint16_t>(ids, live, scratch);
+    }
+    return prune_offsets<uint8_t>(ids, live, scratch);
+}
+
+// Union of colors over live patterns, as cell bitmasks
+void pattern_set::reduce(uint32_t const *ids, size_t live, uint32_t *result,
+                         scratch_t &scratch) const
+{
+    if (wide_)
+    {
+        reduce_offsets<uint16_t>(ids, live, result, scratch);
+    }
+    else
+    {
+        reduce_offsets<uint8_t>(ids, live, result, scratch);
+    }
+}
+
+// Number of live patterns giving each cell each color
+void pattern_set::count(uint32_t const *ids, size_t live,
+                        uint32_t *counts) const
+{
+    if (wide_)
+    {
+        count_offsets<uint16_t>(ids, live, counts);
+    }
+    else
+    {
+        count_offsets<uint8_t>(ids, live, counts);
+    }
+}
+
+// Expand a pattern to cell bitmasks (length cells)
+void pattern_set::unpack(size_t id, uint32_t *pattern) const
+{
+    if (wide_)
+    {
+        unpack_offsets<uint16_t>(id, pattern);
+    }
+    else
+    {
+        unpack_offsets<uint8_t>(id, pattern);
+    }
+}
+
+// Offset storage for each width
+template <>
+arena_vector<uint8_t> &pattern_set::storage<uint8_t>()
+{
+    return narrow_offsets_;
+}
+template <>
+arena_vector<uint16_t> &pattern_set::storage<uint16_t>()
+{
+    return wide_offsets_;
+}
+template <>
+arena_vector<uint8_t> const &pattern_set::storage<uint8_t>() const
+{
+    return narrow_offsets_;
+}
+template <>
+arena_vector<uint16_t> const &pattern_set::storage<uint16_t>() const
+{
+    return wide_offsets_;
+}
+
+// Offset checks for each width
+static void fits(kernels_t const *kern, uint8_t const *offsets,
+                 uint32_t const *ids, size_t n, fit_t const &fit,
+                 uint32_t *keep)
+{
+    kern->fits_narrow(offsets, ids, n, fit, keep);
+}
+static void fits(kernels_t const *kern, uint16_t const *offsets,
+                 uint32_t const *ids, size_t n, fit_t const &fit,
+                 uint32_t *keep)
+{
+    kern->fits_wide(offsets, ids, n, fit, keep);
+}
+
+// Discard patterns no longer matching cells (blocked already counted)
+template <typename offset_t>
+size_t pattern_set::prune_offsets(uint32_t *ids, size_t live,
+                                  scratch_t &scratch) const
+{
+    // Does each segment, and the white space before it, still fit? Those
+    // that don't move past the end of the live range.
+    fit_t fit = { scratch.blocked.data(), seg_slot_.data(), seg_len_.data(),
+                  nsegs_, length_ };
+    scratch.keep.resize(live);
+    scratch.culled.resize(live);
+    kernels_t const *kern = best_kernels();
+    fits(kern, storage<offset_t>().data(), ids, live, fit,
+         scratch.keep.data());
+    return kern->compact(ids, scratch.keep.data(), live,
+                         scratch.culled.data());
+}
+
+// Union of colors over live patterns, as cell bitmasks
+template <typename offset_t>
+void pattern_set::reduce_offsets(uint32_t const *ids, size_t live,
+                                 uint32_t *result, scratch_t &scratch) const
+{
+    offset_t const *base = storage<offset_t>().data();
+    size_t width = length_ + 1;
+
+    // Mark every segment start in use, and every run of white space
+    arena_vector<uint8_t> &seen = scratch.seen;
+    arena_vector<int> &gaps = scratch.gaps;
+    seen.assign(nsegs_ * width, 0);
+    gaps.assign(width, 0);
+    for (size_t k = 0; k < live; k++)
+    {
+        offset_t const *cur = base + (size_t)ids[k] * nsegs_;
+        size_t end = 0;
+        for (size_t j = 0; j < nsegs_; j++)
+        {
+            size_t start = cur[j];
+            seen[j * width + start] = 1;
+            gaps[end]++;
+            gaps[start]--;
+            end = start + seg_len_[j];
+        }
+        gaps[end]++;
+        gaps[length_]--;
+    }
+
+    // White wherever some pattern leaves a gap
+    uint32_t white = color_table[0].bitmask;
+    int depth = 0;
+    for (size_t i = 0; i < length_; i++)
+    {
+        depth += gaps[i];
+        result[i] = (depth > 0) ? white : 0;
+    }
+
+    // Segment color wherever a start within reach was seen
+    for (size_t j = 0; j < nsegs_; j++)
+    {
+        uint8_t const *starts = &seen[j * width];
+        size_t len = seg_len_[j];
+        int window = 0;
+        for (size_t i = 0; i < length_; i++)
+        {
+            window += starts[i];
+            if (i >= len)
+            {
+                window -= starts[i - len];
+            }
+            if (window > 0)
+            {
+                result[i] |= seg_mask_[j];
+            }
+        }
+    }
+}
+
+// Number of live patterns giving each cell each color
+template <typename offset_t>
+void pattern_set::count_offsets(uint32_t const *ids, size_t live,
+                                uint32_t *counts) const
+{
+    offset_t const *base = storage<offset_t>().data();
+    size_t ncolors = color_table_size;
+
+    // Count segment colors, and white wherever no segment is
+    for (size_t i = 0; i < length_ * ncolors; i++)
+    {
+        counts[i] = 0;
+    }
+    for (size_t i = 0; i < length_; i++)
+    {
+        counts[i * ncolors] = live;
+    }
+    for (size_t k = 0; k < live; k++)
+    {
+        offset_t const *cur = base + (size_t)ids[k] * nsegs_;
+        for (size_t j = 0; j < nsegs_; j++)
+        {
+            for (size_t i = cur[j]; i < cur[j] + seg_len_[j]; i++)
+            {
+                counts[i * ncolors + seg_color_[j]]++;
+                counts[i * ncolors]--;
+            }
+        }
+    }
+}
+
+// Expand a pattern to cell bitmasks
+template <typename offset_t>
+void pattern_set::unpack_offsets(size_t id, uint32_t *pattern) const
+{
+    offset_t const *cur = storage<offset_t>().data() + id * nsegs_;
+
+    for (size_t i = 0; i < length_; i++)
+    {
+        pattern[i] = color_table[0].bitmask;
+    }
+    for (size_t j = 0; j < nsegs_; j++)
+    {
+        for (size_t i = cur[j]; i < cur[j] + seg_len_[j]; i++)
+        {
+            pattern[i] = seg_mask_[j];
+        }
+    }
+}
+
+// Prefix counts of cells blocked for each color in use (slot 0 is white)
+void pattern_set::count_blocked(uint32_t const *cells,
+                                scratch_t &scratch) const
+{
+    size_t width = length_ + 1;
+    scratch.blocked.resize(slot_mask_.size() * width);
+    for (size_t s = 0; s < slot_mask_.size(); s++)
+    {
+        int *prefix = &scratch.blocked[s * width];
+        uint32_t mask = slot_mask_[s];
+        prefix[0] = 0;
+        for (size_t i = 0; i < length_; i++)
+        {
+            prefix[i + 1] = prefix[i] + ((cells[i] & mask) == 0);
+        }
+    }
+}
+
+};
@@ -0,0 +1,170 @@
+#ifndef PATTERN_SET_H
+#define PATTERN_SET_H
+
+#include <cstddef>
+#include <functional>
+#include <stdint.h>
+#include "arena.h"
+#include "line_solver.h"
+
+namespace nonogram
+{
+
+// All placements of a rule in a line
+//
+// Each pattern is stored as just the start offset of each segment, packed
+// back to back in one buffer for the line, a byte per offset for lines up
+// to 255 cells and two bytes beyond that. Consistency checks and unions run
+// on the offsets directly, against prefix counts of the cells each segment
+// color (or white) can't cover.
+//
+// Once generated, a set is read only, so lines with the same rule can share
+// it. Each line tracks the patterns it still allows as a list of ids, live
+// ones first.
+class pattern_set
+{
+public:
+
+    // Working space for checks and unions (sets may be shared between
+    // threads, so each user brings its own)
+    struct scratch_t
+    {
+        explicit scratch_t(arena *mem = NULL);
+
+        // Prefix counts of cells blocked for each color in use (slot 0 is
+        // white)
+        arena_vector<int> blocked;
+
+        // Segment starts in use, and white run difference array
+        arena_vector<uint8_t> seen;
+        arena_vector<int> gaps;
+
+        // Keep flag of each live pattern, and ids culled, while pruning
+        arena_vector<uint32_t> keep;
+        arena_vector<uint32_t> culled;
+    };
+
+    // Constructor (storage drawn from mem, or the heap for NULL)
+    explicit pattern_set(arena *mem = NULL);
+
+    // Generate all placements of rule in a line of length cells, asking
+    // stop (if given) every stop_check_interval patterns whether to give
+    // up. False if it did, leaving no patterns.
+    bool generate(rule_t const &rule, size_t length,
+                  std::function<bool()> const *stop = NULL);
+
+    // Patterns placed between calls to stop while generating
+    static size_t const stop_check_interval = 1 << 12;
+
+    // Take count placements made earlier (bytes of packed offsets, as
+    // from offsets()) instead of generating them. False unless they are
+    // all placements of the rule, in the order generated.
+    bool assign(rule_t const &rule, size_t length, void const *offsets,
+                size_t count, size_t bytes);
+
+    // Number of placements of rule in a line of length cells, counted
+    // without generating them (stops early with limit + 1 if more)
+    static size_t placements(rule_t const &rule, size_t length,
+                             size_t limit);
+
+    // Packed offsets, and their size in bytes
+    void const *offsets() const;
+    size_t offset_bytes() const;
+
+    // Number of patterns stored
+    size_t size() const { return count_; }
+
+    // Approximate memory used
+    size_t bytes() const;
+
+    // Discard ids of patterns no longer matching cells, by moving them
+    // past the end of the live range (both ranges keep their order).
+    // Returns new live count.
+    size_t prune(uint32_t *ids, size_t live, uint32_t const *cells,
+                 scratch_t &scratch) const;
+
+    // Union of colors over live patterns, as cell bitmasks
+    void reduce(uint32_t const *ids, size_t live, uint32_t *result,
+                scratch_t &scratch) const;
+
+    // Number of live patterns giving each cell each color, as
+    // counts[cell * color_table_size + color index]
+    void count(uint32_t const *ids, size_t live, uint32_t *counts) const;
+
+    // Expand a pattern to cell bitmasks (length cells)
+    void unpack(size_t id, uint32_t *pattern) const;
+
+private:
+
+    // Set up segments for rule in a line of length cells, with no patterns
+    void set_rule(rule_t const &rule, size_t length);
+
+    // Do count patterns of packed offsets each fit the rule, each later
+    // in the order generated than the one before?
+    template <typename offset_t>
+    bool check_offsets(offset_t const *offsets, size_t count) const;
+
+    // Recursively place segment seg and up, starting no earlier than start
+    void place(size_t seg, size_t start);
+
+    // Offset storage for each width
+    template <typename offset_t>
+    arena_vector<offset_t> &storage();
+    template <typename offset_t>
+    arena_vector<offset_t> const &storage() const;
+
+    // Per-offset-width implementations
+    template <typename offset_t>
+    size_t prune_offsets(uint32_t *ids, size_t live,
+                         scratch_t &scratch) const;
+    template <typename offset_t>
+    void reduce_offsets(uint32_t const *ids, size_t live, uint32_t *result,
+                        scratch_t &scratch) const;
+    template <typename offset_t>
+    void count_offsets(uint32_t const *ids, size_t live,
+                       uint32_t *counts) const;
+    template <typename offset_t>
+    void unpack_offsets(size_t id, uint32_t *pattern) const;
+
+    // Prefix counts of cells blocked for each color in use (slot 0 is white)
+    void count_blocked(uint32_t const *cells, scratch_t &scratch) const;
+    int blocked(scratch_t const &scratch, size_t slot, size_t begin,
+                size_t end) const
+    {
+        int const *prefix = &scratch.blocked[slot * (length_ + 1)];
+        return prefix[end] - prefix[begin];
+    }
+
+    // Non-empty rule segments
+    arena_vector<uint32_t> seg_mask_;
+    arena_vector<size_t> seg_color_;
+    arena_vector<size_t> seg_len_;
+    arena_vector<size_t> seg_slot_;
+    arena_vector<size_t> seg_gap_;
+
+    // Fewest cells needed by segment seg and up (including pad spaces)
+    arena_vector<size_t> seg_tail_;
+
+    // Color bitmask for each prefix slot, and slot for each color
+    arena_vector<uint32_t> slot_mask_;
+    arena_vector<int> slot_by_color_;
+
+    // Dimensions
+    size_t length_;
+    size_t nsegs_;
+    size_t count_;
+    bool wide_;
+
+    // Packed offsets, nsegs_ per pattern (wide_offsets_ when wide_)
+    arena_vector<uint8_t> narrow_offsets_;
+    arena_vector<uint16_t> wide_offsets_;
+
+    // Offsets of pattern being placed, and whether to give up placing
+    arena_vector<size_t> current_;
+    std::function<bool()> const *stop_;
+    bool stopped_;
+};
+
+};
+
+#endif
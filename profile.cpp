@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdio>
+#include "profile.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Stage names, for output
+static char const *stage_names[STAGE_COUNT] =
+{
+    "search", "parse", "patterns", "apply", "prune", "probe", "split",
+    "guess",
+};
+
+// Add a list of counts to a JSON document
+static void json_list(string &out, char const *name,
+                      vector<unsigned long> const &counts)
+{
+    char buf[32];
+    out += ",\"";
+    out += name;
+    out += "\":[";
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        snprintf(buf, sizeof(buf), "%s%lu", (i > 0) ? "," : "", counts[i]);
+        out += buf;
+    }
+    out += "]";
+}
+
+// Constructor
+profile::profile()
+{
+    reset();
+}
+
+// Is profiling built in?
+bool profile::enabled()
+{
+#ifdef NONOGRAM_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Forget everything, ready for another puzzle
+void profile::reset()
+{
+    generated_.clear();
+    pruned_.clear();
+    pattern_bytes_ = 0;
+    start_ticks_ = ticks();
+    start_time_ = chrono::steady_clock::now();
+    clear();
+}
+
+// Make room for per line counters, for nlines rows and columns
+void profile::set_lines(size_t nlines)
+{
+    generated_.assign(nlines, 0);
+    pruned_.assign(nlines, 0);
+}
+
+// Forget times and counters (keeping per line slots), for a branch that
+// will be added to its parent's profile later
+void profile::clear()
+{
+    fill(ticks_, ticks_ + STAGE_COUNT, 0);
+    stage_ = STAGE_COUNT;
+    line_evaluations_ = 0;
+    guesses_ = 0;
+    max_depth_ = 0;
+    fill(pruned_.begin(), pruned_.end(), 0);
+}
+
+// Count a guess made depth guesses deep
+void profile::count_guess(size_t depth)
+{
+    guesses_++;
+    max_depth_ = max(max_depth_, depth);
+}
+
+// Count patterns generated for a line
+void profile::count_patterns(size_t line, unsigned long count)
+{
+    generated_[line] += count;
+}
+
+// Count patterns pruned from a line
+void profile::count_pruned(size_t line, unsigned long count)
+{
+    pruned_[line] += count;
+}
+
+// Count bytes held by patterns
+void profile::count_pattern_bytes(size_t bytes)
+{
+    pattern_bytes_ += bytes;
+}
+
+// Add in a branch's profile
+void profile::add(profile const &other)
+{
+    for (size_t k = 0; k < STAGE_COUNT; k++)
+    {
+        ticks_[k] += other.ticks_[k];
+    }
+    line_evaluations_ += other.line_evaluations_;
+    guesses_ += other.guesses_;
+    max_depth_ = max(max_depth_, other.max_depth_);
+    pruned_.resize(max(pruned_.size(), other.pruned_.size()), 0);
+    for (size_t i = 0; i < other.pruned_.size(); i++)
+    {
+        pruned_[i] += other.pruned_[i];
+    }
+}
+
+// Profile as a JSON document
+string profile::json() const
+{
+    char buf[128];
+    string out = enabled() ? "{\"enabled\":true" : "{\"enabled\":false";
+    if (!enabled())
+    {
+        return out + "}";
+    }
+
+    // Seconds per tick, going by ticks and time since reset
+    chrono::duration<double> elapsed =
+        chrono::steady_clock::now() - start_time_;
+    uint64_t elapsed_ticks = ticks() - start_ticks_;
+    double scale = (elapsed_ticks > 0) ? elapsed.count() / elapsed_ticks : 0;
+
+    out += ",\"seconds\":{";
+    for (size_t k = 0; k < STAGE_COUNT; k++)
+    {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%.6f", (k > 0) ? "," : "",
+                 stage_names[k], ticks_[k] * scale);
+        out += buf;
+    }
+    snprintf(buf, sizeof(buf),
+             "},\"line_evaluations\":%lu,\"guesses\":%lu,\"max_depth\":%zu"
+             ",\"pattern_bytes\":%zu",
+             line_evaluations_, guesses_, max_depth_, pattern_bytes_);
+    out += buf;
+    json_list(out, "generated", generated_);
+    json_list(out, "pruned", pruned_);
+    return out + "}";
+}
+
+};
@@ -0,0 +1,164 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TSC
+#endif
+
+namespace nonogram
+{
+
+// Stages a solve spends its time in (each moment counts toward the
+// innermost stage running)
+typedef enum
+{
+    STAGE_SEARCH,   // Search bookkeeping not counted below
+    STAGE_PARSE,    // Reading and checking rules
+    STAGE_PATTERNS, // Generating (or looking up) pattern sets
+    STAGE_APPLY,    // Filtering lines against the board
+    STAGE_PRUNE,    // Discarding patterns that no longer fit
+    STAGE_PROBE,    // Probing cell colors
+    STAGE_SPLIT,    // Looking for independent parts
+    STAGE_GUESS,    // Picking, stamping and backing out guesses
+    STAGE_COUNT,
+} stage_t;
+
+// Solver profile: time spent in each stage, and counters
+//
+// Hooks in the solver go through the PROFILE_STAGE() and PROFILE_COUNT()
+// macros, which compile to nothing unless NONOGRAM_PROFILE is defined (the
+// default build defines it), so a build without it pays nothing. Parallel
+// branches keep profiles of their own, added in when they finish, so
+// times are summed over threads.
+class profile
+{
+public:
+
+    // Counts time toward a stage while in scope
+    class scope
+    {
+    public:
+
+        scope(profile &prof, stage_t stage)
+            : prof_(prof), outer_(prof.enter(stage))
+        {
+        }
+
+        ~scope() { prof_.leave(outer_); }
+
+    private:
+
+        profile &prof_;
+        stage_t outer_;
+    };
+
+    // Constructor
+    profile();
+
+    // Is profiling built in?
+    static bool enabled();
+
+    // Forget everything, ready for another puzzle
+    void reset();
+
+    // Make room for per line counters, for nlines rows and columns
+    void set_lines(size_t nlines);
+
+    // Forget times and counters (keeping per line slots), for a branch
+    // that will be added to its parent's profile later
+    void clear();
+
+    // Start counting time toward a stage (returns the stage before)
+    stage_t enter(stage_t stage)
+    {
+        mark();
+        stage_t outer = stage_;
+        stage_ = stage;
+        return outer;
+    }
+
+    // Go back to counting time toward an outer stage
+    void leave(stage_t outer)
+    {
+        mark();
+        stage_ = outer;
+    }
+
+    // Counters
+    void count_line() { line_evaluations_++; }
+    void count_guess(size_t depth);
+    void count_patterns(size_t line, unsigned long count);
+    void count_pruned(size_t line, unsigned long count);
+    void count_pattern_bytes(size_t bytes);
+
+    // Add in a branch's profile
+    void add(profile const &other);
+
+    // Profile as a JSON document
+    std::string json() const;
+
+private:
+
+    // Current tick count (reading the clock costs several times as much
+    // as the timestamp counter, which adds up over millions of lines)
+    static uint64_t ticks()
+    {
+#ifdef PROFILE_TSC
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // Add ticks since the last mark to the stage running (if any)
+    void mark()
+    {
+        uint64_t now = ticks();
+        if (stage_ != STAGE_COUNT)
+        {
+            ticks_[stage_] += now - mark_;
+        }
+        mark_ = now;
+    }
+
+    // Ticks (timestamp counter, or clock where there's none) in each
+    // stage, the stage running (STAGE_COUNT for none), and when it was
+    // last counted
+    uint64_t ticks_[STAGE_COUNT];
+    stage_t stage_;
+    uint64_t mark_;
+
+    // Tick count and time at reset, to work out seconds per tick
+    uint64_t start_ticks_;
+    std::chrono::steady_clock::time_point start_time_;
+
+    // Line evaluations, guesses, deepest guess, and bytes held by pattern
+    // sets and id lists (all allocated up front, so also the peak)
+    unsigned long line_evaluations_;
+    unsigned long guesses_;
+    size_t max_depth_;
+    size_t pattern_bytes_;
+
+    // Patterns generated and pruned for each line (rows, then columns)
+    std::vector<unsigned long> generated_;
+    std::vector<unsigned long> pruned_;
+};
+
+};
+
+#ifdef NONOGRAM_PROFILE
+#define PROFILE_STAGE(prof, stage) \
+    nonogram::profile::scope profile_scope_(prof, stage)
+#define PROFILE_COUNT(expr) expr
+#else
+#define PROFILE_STAGE(prof, stage)
+#define PROFILE_COUNT(expr)
+#endif
+
+#endif
@@ -0,0 +1,585 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "json.h"
+#include "solver.h"
+#include "tools.h"
+using namespace std;
+using namespace nonogram;
+
+// Show command line usage
+static void usage(char const *name)
+{
+    cerr << "Usage: " << name << " [-e patterns|dp] [-r reps] [-d seconds]"
+         << " [-n] [-o results.json] [-b baseline.json] [-t percent]"
+         << " [-f ms] [dir|glob|puzzle.in|puzzle.nonb|corpus] ..." << endl;
+    cerr << "  -e  Line solving engine (default patterns)" << endl;
+    cerr << "  -r  Times to load and solve each puzzle (default 10)" << endl;
+    cerr << "  -d  Seconds allowed per solve (default 60)" << endl;
+    cerr << "  -n  Leave out the generated stress puzzles" << endl;
+    cerr << "  -o  Write results as JSON, for use as a later baseline"
+         << endl;
+    cerr << "  -b  Compare with the results of an earlier run" << endl;
+    cerr << "  -t  Slowdown over the baseline flagged as a regression"
+         << " (default 10)" << endl;
+    cerr << "  -f  Slowdowns this small are never flagged (default 0.5)"
+         << endl;
+    cerr << "Each puzzle runs in a process of its own, so its peak RSS is"
+         << " its own, and" << endl;
+    cerr << "the exit status is 1 if the baseline comparison found a"
+         << " regression" << endl;
+    exit(1);
+}
+
+// Generated stress puzzle: a random board, described by its own rules
+typedef struct
+{
+    size_t ncols;   // Dimensions
+    size_t nrows;
+    size_t ncolors; // Colors filled in, besides white
+    unsigned fill;  // Percentage of cells filled
+} stress_t;
+
+// Stress puzzles, from quick to heavy on guessing and pattern generation
+static stress_t const stress[] =
+{
+    { 20, 20, 1, 55 },
+    { 30, 30, 1, 60 },
+    { 40, 40, 1, 65 },
+    { 80, 80, 1, 80 },
+    { 25, 25, 2, 65 },
+    { 25, 25, 3, 80 },
+};
+
+// Seed of the first stress puzzle (each one has its own, so the others
+// stay the same when one is added)
+static unsigned const stress_seed = 1;
+
+// Puzzle to measure
+typedef struct
+{
+    string name;     // Shown, and matched against the baseline
+    string filename; // Binary image to load (empty for puzzle)
+    puzzle_t puzzle;
+} bench_t;
+
+// Measurements of a puzzle, passed back from the process that ran it
+typedef struct
+{
+    char status[16];          // As in batch output, or "error"
+    char error[256];          // Why, for "error"
+    double complete;          // Percentage of cells solved
+    unsigned long patterns;   // Patterns generated when loaded
+    unsigned long guesses;    // Guesses of a solve
+    double load_median;       // Seconds
+    double solve_median;
+    double solve_p99;
+    long base_rss;            // KB resident when the process started
+    long peak_rss;            // KB, filled in from the process's usage, less
+                              // base_rss
+} sample_t;
+
+// Memory resident in this process now, in KB (0 if unknown)
+static long resident_kb()
+{
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%*ld %ld", &pages) != 1)
+        {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Add the puzzles of a file (each one of a corpus, named by index or its
+// delimiter line), throwing if it can't be read
+static void add_file(vector<bench_t> &benches, string const &filename)
+{
+    if (puzzle_image::recognize(filename.c_str()))
+    {
+        benches.push_back(bench_t());
+        benches.back().name = filename;
+        benches.back().filename = filename;
+        return;
+    }
+
+    puzzle_reader reader;
+    reader.open(filename.c_str());
+    size_t first = benches.size();
+    benches.push_back(bench_t());
+    while (reader.next(benches.back().puzzle))
+    {
+        benches.push_back(bench_t());
+    }
+    benches.pop_back();
+    if (benches.size() == first)
+    {
+        throw runtime_error("Cannot read from file");
+    }
+
+    // A lone puzzle goes by its file name
+    for (size_t i = first; i < benches.size(); i++)
+    {
+        benches[i].name = filename;
+        if (benches.size() - first > 1)
+        {
+            string const &name = benches[i].puzzle.name;
+            benches[i].name += ":" +
+                (name.empty() ? to_string(i - first) : name);
+        }
+    }
+}
+
+// Fill in a stress puzzle: a random board, and the rules that describe it
+// (so it has at least one solution)
+static void generate(bench_t &bench, stress_t const &spec, unsigned seed)
+{
+    random_puzzle(bench.puzzle, spec.ncols, spec.nrows, spec.ncolors,
+                  spec.fill, seed);
+    char name[64];
+    snprintf(name, sizeof(name), "stress/%zux%zu-%zuc-%u%%", spec.ncols,
+             spec.nrows, spec.ncolors, spec.fill);
+    bench.name = name;
+}
+
+// Median of sorted times
+static double median(vector<double> const &sorted)
+{
+    size_t mid = sorted.size() / 2;
+    return (sorted.size() % 2) ? sorted[mid] :
+                                 (sorted[mid - 1] + sorted[mid]) / 2;
+}
+
+// Time that a share (0 to 1) of sorted times are within, by nearest rank
+static double percentile(vector<double> const &sorted, double share)
+{
+    size_t rank = (size_t)ceil(share * sorted.size());
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+// Load and solve a puzzle reps times, each time with a new solver (so
+// patterns are generated afresh, or taken from the image)
+static void measure(bench_t const &bench, engine_t engine, size_t reps,
+                    limits_t const &limits, sample_t &sample)
+{
+    vector<double> loads;
+    vector<double> solves;
+    for (size_t rep = 0; rep < reps; rep++)
+    {
+        solver app;
+        app.set_limits(limits);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (bench.filename.empty())
+        {
+            app.load(bench.puzzle, engine);
+        }
+        else
+        {
+            app.load(bench.filename.c_str(), engine);
+        }
+        chrono::duration<double> elapsed =
+            chrono::steady_clock::now() - start;
+        loads.push_back(elapsed.count());
+        sample.patterns = app.pattern_count();
+
+        result_t result = app.solve();
+        solves.push_back(result.seconds);
+        sample.complete = result.complete;
+        sample.guesses = result.guesses;
+        char const *status = result.solved ? "solved" : "unsolved";
+        if (result.status == STATUS_TIMEOUT)
+        {
+            status = "timeout";
+        }
+        else if (result.status == STATUS_UNSOLVABLE)
+        {
+            status = "unsolvable";
+        }
+        snprintf(sample.status, sizeof(sample.status), "%s", status);
+    }
+
+    sort(loads.begin(), loads.end());
+    sort(solves.begin(), solves.end());
+    sample.load_median = median(loads);
+    sample.solve_median = median(solves);
+    sample.solve_p99 = percentile(solves, 0.99);
+}
+
+// Measure a puzzle in a child process, whose peak RSS, less what it
+// inherits from the bench, is then the puzzle's alone
+static void run(bench_t const &bench, engine_t engine, size_t reps,
+                limits_t const &limits, sample_t &sample)
+{
+    memset(&sample, 0, sizeof(sample));
+    snprintf(sample.status, sizeof(sample.status), "error");
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        snprintf(sample.error, sizeof(sample.error), "Cannot make pipe");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        snprintf(sample.error, sizeof(sample.error), "Cannot fork");
+        return;
+    }
+
+    if (pid == 0)
+    {
+        // Pages shared with the bench at fork count towards the peak, so
+        // note them to take off again
+        sample.base_rss = resident_kb();
+        close(fds[0]);
+        try
+        {
+            measure(bench, engine, reps, limits, sample);
+        }
+        catch (exception &e)
+        {
+            snprintf(sample.status, sizeof(sample.status), "error");
+            snprintf(sample.error, sizeof(sample.error), "%s", e.what());
+        }
+        bool sent = (write(fds[1], &sample, sizeof(sample)) ==
+                     (ssize_t)sizeof(sample));
+        _exit(sent ? 0 : 1);
+    }
+
+    close(fds[1]);
+    size_t got = 0;
+    while (got < sizeof(sample))
+    {
+        ssize_t bytes = read(fds[0], (char *)&sample + got,
+                             sizeof(sample) - got);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        got += bytes;
+    }
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    wait4(pid, &status, 0, &usage);
+    if (got < sizeof(sample))
+    {
+        memset(&sample, 0, sizeof(sample));
+        snprintf(sample.status, sizeof(sample.status), "error");
+        snprintf(sample.error, sizeof(sample.error), "%s",
+                 WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) :
+                                       "Lost measurements");
+    }
+    sample.peak_rss = max(usage.ru_maxrss - sample.base_rss, 0L);
+}
+
+// Format a puzzle's measurements as a JSON object
+static string sample_json(bench_t const &bench, sample_t const &sample)
+{
+    string out = "{\"name\":" + json_string(bench.name) +
+                 ",\"status\":" + json_string(sample.status);
+    if (strcmp(sample.status, "error") == 0)
+    {
+        return out + ",\"error\":" + json_string(sample.error) + "}";
+    }
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             ",\"complete\":%.1f,\"patterns\":%lu,\"guesses\":%lu"
+             ",\"load_median\":%.6f,\"solve_median\":%.6f"
+             ",\"solve_p99\":%.6f,\"peak_rss_kb\":%ld}",
+             sample.complete, sample.patterns, sample.guesses,
+             sample.load_median, sample.solve_median, sample.solve_p99,
+             sample.peak_rss);
+    return out + buf;
+}
+
+// Number held by a member of a JSON object (-1 if missing)
+static double json_number(json_t const &object, char const *name)
+{
+    json_t const *member = json_member(object, name);
+    return (member && (member->type == json_t::JSON_NUMBER)) ?
+           member->number : -1;
+}
+
+// Results of an earlier run, by puzzle name, throwing if they can't be
+// read
+static void read_baseline(char const *filename, json_t &results,
+                          map<string, json_t const *> &baseline)
+{
+    ifstream in(filename);
+    if (!in.good())
+    {
+        throw runtime_error("Cannot open file");
+    }
+    stringstream text;
+    text << in.rdbuf();
+    string data = text.str();
+    char const *pos = data.data();
+    char const *end = pos + data.size();
+    json_t const *puzzles = NULL;
+    if (json_parse(pos, end, results) &&
+        (results.type == json_t::JSON_OBJECT))
+    {
+        puzzles = json_member(results, "puzzles");
+    }
+    if (!puzzles || (puzzles->type != json_t::JSON_ARRAY))
+    {
+        throw runtime_error("Not a bench results file");
+    }
+    for (size_t i = 0; i < puzzles->items.size(); i++)
+    {
+        json_t const *name = json_member(puzzles->items[i], "name");
+        if (name && (name->type == json_t::JSON_STRING))
+        {
+            baseline[name->text] = &puzzles->items[i];
+        }
+    }
+}
+
+// Compare one measured time with the baseline's, showing it if it slowed
+// by more than the threshold (true if so)
+static bool regressed(string const &name, char const *what, double now,
+                      json_t const &before, double threshold, double floor)
+{
+    double then = json_number(before, what);
+    if ((then < 0) || (now <= then * (1 + threshold / 100)) ||
+        (now - then <= floor))
+    {
+        return false;
+    }
+    printf("REGRESSION %s: %s %.3f ms -> %.3f ms (%+.1f%%)\n", name.c_str(),
+           what, then * 1000, now * 1000,
+           (then > 0) ? (now / then - 1) * 100 : 100.0);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    engine_t engine = ENGINE_PATTERNS;
+    size_t reps = 10;
+    limits_t limits = { 60, 0, NULL };
+    bool use_stress = true;
+    char const *output = NULL;
+    char const *baseline_file = NULL;
+    double threshold = 10;
+    double floor = 0.5e-3;
+    vector<string> files;
+    unsigned long number;
+
+    // Parse command line
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-e") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!engine_named(argv[i], engine))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 1, UINT32_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            reps = number;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            limits.seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            use_stress = false;
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            output = argv[i];
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            baseline_file = argv[i];
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            threshold = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            floor = atof(argv[i]) / 1000;
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            add_path(files, argv[i]);
+        }
+    }
+
+    // Puzzles to measure: files given, then stress puzzles
+    vector<bench_t> benches;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        try
+        {
+            add_file(benches, files[i]);
+        }
+        catch (exception &e)
+        {
+            cerr << files[i] << ": " << e.what() << endl;
+            return 1;
+        }
+    }
+    size_t nstress = use_stress ? sizeof(stress) / sizeof(stress[0]) : 0;
+    for (size_t k = 0; k < nstress; k++)
+    {
+        benches.push_back(bench_t());
+        generate(benches.back(), stress[k], stress_seed + k);
+    }
+    if (benches.empty())
+    {
+        cerr << "No puzzles to measure" << endl;
+        usage(argv[0]);
+    }
+
+    json_t results;
+    map<string, json_t const *> baseline;
+    if (baseline_file)
+    {
+        try
+        {
+            read_baseline(baseline_file, results, baseline);
+        }
+        catch (exception &e)
+        {
+            cerr << baseline_file << ": " << e.what() << endl;
+            return 1;
+        }
+    }
+
+    // Measure each puzzle, comparing as we go
+    printf("%-32s %-10s %10s %8s %9s %9s %9s %9s\n", "puzzle", "status",
+           "patterns", "guesses", "load ms", "median ms", "p99 ms",
+           "peak KB");
+    fflush(stdout);
+    string json = "{\"reps\":" + to_string(reps) + ",\"engine\":" +
+                  json_string(engine_name(engine)) +
+                  ",\"puzzles\":[";
+    size_t regressions = 0;
+    for (size_t i = 0; i < benches.size(); i++)
+    {
+        bench_t const &bench = benches[i];
+        sample_t sample;
+        run(bench, engine, reps, limits, sample);
+        json += string(i ? "," : "") + "\n" + sample_json(bench, sample);
+
+        if (strcmp(sample.status, "error") == 0)
+        {
+            printf("%-32s %-10s %s\n", bench.name.c_str(), sample.status,
+                   sample.error);
+        }
+        else
+        {
+            printf("%-32s %-10s %10lu %8lu %9.3f %9.3f %9.3f %9ld\n",
+                   bench.name.c_str(), sample.status, sample.patterns,
+                   sample.guesses, sample.load_median * 1000,
+                   sample.solve_median * 1000, sample.solve_p99 * 1000,
+                   sample.peak_rss);
+        }
+
+        map<string, json_t const *>::const_iterator before =
+            baseline.find(bench.name);
+        if (before == baseline.end())
+        {
+            fflush(stdout);
+            continue;
+        }
+        // Losing a solve counts, as does slowing down at the same one
+        json_t const *then = json_member(*before->second, "status");
+        bool same = then && (then->text == sample.status);
+        if (!same && then && (then->text == "solved"))
+        {
+            printf("REGRESSION %s: status %s -> %s\n", bench.name.c_str(),
+                   then->text.c_str(), sample.status);
+            regressions++;
+        }
+        else if (same && (strcmp(sample.status, "error") != 0))
+        {
+            regressions += regressed(bench.name, "load_median",
+                                     sample.load_median, *before->second,
+                                     threshold, floor);
+            regressions += regressed(bench.name, "solve_median",
+                                     sample.solve_median, *before->second,
+                                     threshold, floor);
+        }
+        fflush(stdout);
+    }
+    json += "\n]}\n";
+
+    if (output)
+    {
+        ofstream out(output);
+        out << json;
+        if (!out.good())
+        {
+            cerr << output << ": Cannot write file" << endl;
+            return 1;
+        }
+    }
+    if (baseline_file)
+    {
+        printf("%zu regression%s over %g%% against %s\n", regressions,
+               (regressions == 1) ? "" : "s", threshold, baseline_file);
+    }
+
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+#include "colors.h"
+#include "puzzle_builder.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Start a puzzle of ncols by nrows cells in puzzle
+puzzle_builder::puzzle_builder(puzzle_t &puzzle, size_t ncols, size_t nrows)
+    : puzzle_(puzzle)
+{
+    puzzle_.name.clear();
+    puzzle_.ncols = ncols;
+    puzzle_.nrows = nrows;
+    puzzle_.elements.clear();
+    puzzle_.first.assign(1, 0);
+}
+
+// Add the next rule, as counts of black cells
+puzzle_builder &puzzle_builder::rule(vector<int> const &counts)
+{
+    next_rule();
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        segment(counts[i]);
+    }
+    return *this;
+}
+
+// Add the next rule, as (color index, count) pairs
+puzzle_builder &puzzle_builder::rule_elements(
+    vector<rule_element_t> const &elements)
+{
+    next_rule();
+    puzzle_.elements.insert(puzzle_.elements.end(), elements.begin(),
+                            elements.end());
+    puzzle_.first.back() = puzzle_.elements.size();
+    return *this;
+}
+
+// Start the next rule
+puzzle_builder &puzzle_builder::next_rule()
+{
+    puzzle_.first.push_back(puzzle_.elements.size());
+    return *this;
+}
+
+// Add a segment to the rule last started
+puzzle_builder &puzzle_builder::segment(int count, char const *color)
+{
+    // Unknown colors are left for the solver to reject
+    rule_element_t element;
+    element.count = count;
+    if (!color_table_lookup(color, element.color_idx))
+    {
+        element.color_idx = -1;
+    }
+    puzzle_.elements.push_back(element);
+    puzzle_.first.back() = puzzle_.elements.size();
+    return *this;
+}
+
+};
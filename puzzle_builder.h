@@ -0,0 +1,52 @@
+#ifndef PUZZLE_BUILDER_H
+#define PUZZLE_BUILDER_H
+
+#include <cstddef>
+#include <vector>
+#include "line_solver.h"
+#include "puzzle_reader.h"
+
+namespace nonogram
+{
+
+// Builds a puzzle in memory, one rule at a time (rows first, then
+// columns), for solver::reset()
+//
+//     puzzle_t puzzle;
+//     puzzle_builder(puzzle, 2, 2).rule({ 2 }).rule({ 1 })
+//                                 .rule({ 2 }).rule({ 1 });
+//
+// Nothing is checked here: a color token not in the color table, or the
+// wrong number of rules, makes reset() fail with the reason.
+class puzzle_builder
+{
+public:
+
+    // Start a puzzle of ncols by nrows cells in puzzle (reusing its
+    // storage)
+    puzzle_builder(puzzle_t &puzzle, size_t ncols, size_t nrows);
+
+    // Add the next rule, as counts of black cells
+    puzzle_builder &rule(std::vector<int> const &counts);
+
+    // Add the next rule, as (color index, count) pairs
+    puzzle_builder &rule_elements(
+        std::vector<rule_element_t> const &elements);
+
+    // Add the next rule a segment at a time: start it, then add each
+    // segment, in a color named by its token (as in puzzle files)
+    puzzle_builder &next_rule();
+    puzzle_builder &segment(int count, char const *color = "K");
+
+    // Number of rules added so far
+    size_t rules() const { return puzzle_.first.size() - 1; }
+
+private:
+
+    // Puzzle being built
+    puzzle_t &puzzle_;
+};
+
+};
+
+#endif
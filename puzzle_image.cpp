@@ -0,0 +1,280 @@
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "colors.h"
+#include "puzzle_image.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Round a size up to the next part boundary
+static uint64_t align(uint64_t bytes)
+{
+    return (bytes + 7) & ~(uint64_t)7;
+}
+
+// Write one part of an image, padded out to the next part boundary
+static void write_part(FILE *out, void const *data, size_t bytes)
+{
+    static char const padding[8] = { 0 };
+    fwrite(data, 1, bytes, out);
+    fwrite(padding, 1, align(bytes) - bytes, out);
+}
+
+// Constructor
+puzzle_image::puzzle_image()
+    : data_(NULL), size_(0), header_(NULL), first_(NULL), elements_(NULL),
+      sets_(NULL)
+{
+}
+
+// Destructor
+puzzle_image::~puzzle_image()
+{
+    close();
+}
+
+// Does a file start like an image?
+bool puzzle_image::recognize(char const *filename)
+{
+    char magic[4];
+    FILE *in = fopen(filename, "rb");
+    if (in == NULL)
+    {
+        return false;
+    }
+    bool found = (fread(magic, 1, sizeof(magic), in) == sizeof(magic)) &&
+                 (memcmp(magic, "NONB", sizeof(magic)) == 0);
+    fclose(in);
+    return found;
+}
+
+// Map an image, throwing if it can't be read or is damaged
+void puzzle_image::open(char const *filename)
+{
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open file");
+    }
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) || !S_ISREG(info.st_mode) ||
+        (info.st_size < (off_t)sizeof(image_header_t)))
+    {
+        ::close(fd);
+        throw runtime_error("Not a puzzle image");
+    }
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        throw runtime_error("Cannot map file");
+    }
+    data_ = (char const *)data;
+    size_ = info.st_size;
+
+    try
+    {
+        check();
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+// Drop the image
+void puzzle_image::close()
+{
+    if (data_)
+    {
+        munmap((void *)data_, size_);
+    }
+    data_ = NULL;
+    size_ = 0;
+    header_ = NULL;
+    first_ = NULL;
+    elements_ = NULL;
+    sets_ = NULL;
+}
+
+// Check everything in the image lies inside it, and rules are in range
+void puzzle_image::check()
+{
+    header_ = (image_header_t const *)data_;
+    if (memcmp(header_->magic, "NONB", sizeof(header_->magic)) != 0)
+    {
+        throw runtime_error("Not a puzzle image");
+    }
+    if (header_->version != version)
+    {
+        throw runtime_error("Unsupported puzzle image version");
+    }
+    if ((header_->ncols == 0) || (header_->nrows == 0))
+    {
+        throw runtime_error("Puzzle dimensions must be positive");
+    }
+
+    // Parts before the pattern data
+    uint64_t nlines = (uint64_t)header_->nrows + header_->ncols;
+    uint64_t pos = align(sizeof(image_header_t));
+    first_ = (uint32_t const *)(data_ + pos);
+    pos += align((nlines + 1) * sizeof(uint32_t));
+    elements_ = (rule_element_t const *)(data_ + pos);
+    pos += align((uint64_t)header_->nelements * sizeof(rule_element_t));
+    sets_ = (image_set_t const *)(data_ + pos);
+    pos += (uint64_t)header_->nsets * sizeof(image_set_t);
+    if (pos > size_)
+    {
+        throw runtime_error("Damaged puzzle image");
+    }
+
+    // Rules
+    if ((first_[0] != 0) || (first_[nlines] != header_->nelements))
+    {
+        throw runtime_error("Damaged puzzle image");
+    }
+    for (size_t line = 0; line < nlines; line++)
+    {
+        if (first_[line] > first_[line + 1])
+        {
+            throw runtime_error("Damaged puzzle image");
+        }
+    }
+    for (size_t i = 0; i < header_->nelements; i++)
+    {
+        if ((elements_[i].color_idx < 0) ||
+            ((size_t)elements_[i].color_idx >= color_table_size) ||
+            (elements_[i].count < 0))
+        {
+            throw runtime_error("Damaged puzzle image");
+        }
+    }
+
+    // Pattern data (checked against rules when taken)
+    for (size_t k = 0; k < header_->nsets; k++)
+    {
+        image_set_t const &set = sets_[k];
+        if ((set.line >= nlines) || (set.packed > 1) || (set.offset % 8) ||
+            (set.offset < pos) || (set.offset > size_) ||
+            (set.bytes > size_ - set.offset))
+        {
+            throw runtime_error("Damaged puzzle image");
+        }
+    }
+}
+
+// Write a puzzle as an image, with pattern sets from cache
+void puzzle_image::write(char const *filename, puzzle_t const &puzzle,
+                         pattern_cache *cache)
+{
+    size_t nlines = puzzle.nrows + puzzle.ncols;
+    if (puzzle.first.size() != nlines + 1)
+    {
+        throw runtime_error("Puzzle must have a rule for each row and column");
+    }
+
+    // Black and white puzzles are solved with pattern bits
+    int black = color_table_lookup("K");
+    bool packed = true;
+    for (size_t i = 0; i < puzzle.elements.size(); i++)
+    {
+        if (puzzle.elements[i].color_idx != black)
+        {
+            packed = false;
+        }
+    }
+
+    // Pattern set of each distinct rule and length
+    vector<image_set_t> sets;
+    vector<shared_ptr<pattern_set const> > patterns;
+    vector<shared_ptr<packed_patterns const> > bits;
+    map<vector<int>, size_t> seen;
+    for (size_t line = 0; cache && (line < nlines); line++)
+    {
+        size_t length = (line < puzzle.nrows) ? puzzle.ncols : puzzle.nrows;
+        rule_t rule(puzzle.elements.begin() + puzzle.first[line],
+                    puzzle.elements.begin() + puzzle.first[line + 1]);
+        vector<int> key(1, length);
+        for (size_t i = 0; i < rule.size(); i++)
+        {
+            key.push_back(rule[i].color_idx);
+            key.push_back(rule[i].count);
+        }
+        if (!seen.insert(make_pair(key, sets.size())).second)
+        {
+            continue;
+        }
+
+        image_set_t set;
+        set.line = line;
+        set.packed = packed;
+        if (packed)
+        {
+            bits.push_back(cache->packed(rule, length));
+            set.count = bits.back()->size();
+            set.bytes = bits.back()->bit_bytes();
+        }
+        else
+        {
+            patterns.push_back(cache->patterns(rule, length));
+            set.count = patterns.back()->size();
+            set.bytes = patterns.back()->offset_bytes();
+        }
+        sets.push_back(set);
+    }
+
+    // Lay out parts
+    image_header_t header;
+    memcpy(header.magic, "NONB", sizeof(header.magic));
+    header.version = version;
+    header.ncols = puzzle.ncols;
+    header.nrows = puzzle.nrows;
+    header.nelements = puzzle.elements.size();
+    header.nsets = sets.size();
+    vector<uint32_t> first(puzzle.first.begin(), puzzle.first.end());
+    uint64_t pos = align(sizeof(header)) +
+                   align(first.size() * sizeof(uint32_t)) +
+                   align(puzzle.elements.size() * sizeof(rule_element_t)) +
+                   sets.size() * sizeof(image_set_t);
+    for (size_t k = 0; k < sets.size(); k++)
+    {
+        sets[k].offset = pos;
+        pos += align(sets[k].bytes);
+    }
+
+    // Write them out
+    FILE *out = fopen(filename, "wb");
+    if (out == NULL)
+    {
+        throw runtime_error("Cannot write file");
+    }
+    write_part(out, &header, sizeof(header));
+    write_part(out, first.data(), first.size() * sizeof(uint32_t));
+    write_part(out, puzzle.elements.data(),
+               puzzle.elements.size() * sizeof(rule_element_t));
+    write_part(out, sets.data(), sets.size() * sizeof(image_set_t));
+    for (size_t k = 0; k < sets.size(); k++)
+    {
+        write_part(out, packed ? bits[k]->bits() : patterns[k]->offsets(),
+                   sets[k].bytes);
+    }
+    bool failed = ferror(out);
+    if ((fclose(out) != 0) || failed)
+    {
+        throw runtime_error("Cannot write file");
+    }
+}
+
+};
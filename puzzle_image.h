@@ -0,0 +1,116 @@
+#ifndef PUZZLE_IMAGE_H
+#define PUZZLE_IMAGE_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "line_solver.h"
+#include "pattern_cache.h"
+#include "puzzle_reader.h"
+
+namespace nonogram
+{
+
+// Image file header
+typedef struct
+{
+    char magic[4];      // "NONB"
+    uint32_t version;
+    uint32_t ncols;     // Dimensions
+    uint32_t nrows;
+    uint32_t nelements; // Rule elements, all lines
+    uint32_t nsets;     // Pattern sets stored
+} image_header_t;
+
+// Pattern set stored in an image, for one distinct rule
+typedef struct
+{
+    uint32_t line;      // First line with the rule
+    uint32_t packed;    // Pattern bits (1), or segment offsets (0)
+    uint64_t count;     // Number of patterns
+    uint64_t offset;    // Pattern data, from the start of the file
+    uint64_t bytes;
+} image_set_t;
+
+// Binary puzzle image
+//
+// Holds a puzzle's rules, already split into (color index, count) pairs
+// laid out as rule_element_t, so the solver takes them straight from the
+// mapped file, and optionally the pattern set of each distinct rule (bits
+// for black and white puzzles, segment offsets otherwise), so it skips
+// generating those too. Images are written by the convert tool, once the
+// rules pass the solver's sanity checks, in native byte order. Each part
+// starts on an 8 byte boundary:
+//
+//   image_header_t
+//   uint32_t first[nrows + ncols + 1]   Each line's first element (rows,
+//                                       then columns), and the end
+//   rule_element_t elements[nelements]
+//   image_set_t sets[nsets]
+//   Pattern data of each set
+class puzzle_image
+{
+public:
+
+    // Format version written, and the only one read
+    static uint32_t const version = 1;
+
+    // Constructor
+    puzzle_image();
+
+    // Destructor
+    ~puzzle_image();
+
+    // Does a file start like an image?
+    static bool recognize(char const *filename);
+
+    // Map an image, throwing if it can't be read or is damaged
+    void open(char const *filename);
+
+    // Drop the image
+    void close();
+
+    // Dimensions
+    size_t ncols() const { return header_->ncols; }
+    size_t nrows() const { return header_->nrows; }
+
+    // Rule of a line (rows, then columns), as a range of elements
+    rule_element_t const *rule_begin(size_t line) const
+    {
+        return elements_ + first_[line];
+    }
+    rule_element_t const *rule_end(size_t line) const
+    {
+        return elements_ + first_[line + 1];
+    }
+
+    // Pattern sets stored, and their data
+    size_t nsets() const { return header_->nsets; }
+    image_set_t const &set(size_t k) const { return sets_[k]; }
+    void const *set_data(size_t k) const { return data_ + sets_[k].offset; }
+
+    // Write a puzzle as an image, with pattern sets from cache (or none for
+    // NULL), throwing if it can't be written
+    static void write(char const *filename, puzzle_t const &puzzle,
+                      pattern_cache *cache);
+
+private:
+
+    // Not copyable
+    puzzle_image(puzzle_image const &);
+    puzzle_image &operator=(puzzle_image const &);
+
+    // Check everything in the image lies inside it, and rules are in range
+    void check();
+
+    // Mapped file, and its parts
+    char const *data_;
+    size_t size_;
+    image_header_t const *header_;
+    uint32_t const *first_;
+    rule_element_t const *elements_;
+    image_set_t const *sets_;
+};
+
+};
+
+#endif
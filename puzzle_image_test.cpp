@@ -0,0 +1,296 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pattern_cache.h"
+#include "puzzle_image.h"
+#include "solver.h"
+#include "tools.h"
+using namespace std;
+using namespace nonogram;
+
+// Count a failed check, naming it
+static int check(bool ok, string const &what)
+{
+    if (!ok)
+    {
+        printf("FAIL %s\n", what.c_str());
+    }
+    return ok ? 0 : 1;
+}
+
+// Whole file, or write one
+static vector<char> read_file(string const &filename)
+{
+    vector<char> data;
+    FILE *in = fopen(filename.c_str(), "rb");
+    if (in)
+    {
+        char buf[4096];
+        size_t got;
+        while ((got = fread(buf, 1, sizeof(buf), in)) > 0)
+        {
+            data.insert(data.end(), buf, buf + got);
+        }
+        fclose(in);
+    }
+    return data;
+}
+static void write_file(string const &filename, vector<char> const &data)
+{
+    FILE *out = fopen(filename.c_str(), "wb");
+    if (out)
+    {
+        fwrite(data.data(), 1, data.size(), out);
+        fclose(out);
+    }
+}
+
+// Does opening an image fail?
+static bool open_fails(string const &filename)
+{
+    puzzle_image image;
+    try
+    {
+        image.open(filename.c_str());
+    }
+    catch (runtime_error const &)
+    {
+        return true;
+    }
+    return false;
+}
+
+// Does an image open, but fail to load into the solver?
+static bool load_fails(string const &filename)
+{
+    puzzle_image image;
+    solver app;
+    try
+    {
+        image.open(filename.c_str());
+    }
+    catch (runtime_error const &)
+    {
+        return false;
+    }
+    try
+    {
+        app.load(image);
+    }
+    catch (runtime_error const &)
+    {
+        return true;
+    }
+    return false;
+}
+
+// Parts of an image, as offsets into the file (see puzzle_image)
+typedef struct
+{
+    size_t first;
+    size_t elements;
+    size_t sets;
+} layout_t;
+
+static layout_t layout(vector<char> const &data)
+{
+    image_header_t header;
+    memcpy(&header, data.data(), sizeof(header));
+    size_t nlines = header.nrows + header.ncols;
+    layout_t parts;
+    parts.first = (sizeof(header) + 7) & ~(size_t)7;
+    parts.elements = parts.first +
+                     (((nlines + 1) * sizeof(uint32_t) + 7) & ~(size_t)7);
+    parts.sets = parts.elements +
+                 ((header.nelements * sizeof(rule_element_t) + 7) &
+                  ~(size_t)7);
+    return parts;
+}
+
+// Write a puzzle as an image and read it back: same rules, the pattern
+// sets in the cache, and the same solution
+static int test_round_trip(puzzle_t const &puzzle, string const &filename,
+                           string const &name)
+{
+    int failures = 0;
+    pattern_cache cache(~(size_t)0);
+    puzzle_image::write(filename.c_str(), puzzle, &cache);
+    failures += check(puzzle_image::recognize(filename.c_str()),
+                      name + ": recognized");
+
+    puzzle_image image;
+    image.open(filename.c_str());
+    failures += check((image.ncols() == puzzle.ncols) &&
+                      (image.nrows() == puzzle.nrows), name + ": dims");
+    bool same_rules = true;
+    for (size_t line = 0; line < puzzle.nrows + puzzle.ncols; line++)
+    {
+        size_t count = image.rule_end(line) - image.rule_begin(line);
+        same_rules = same_rules &&
+            (count == puzzle.first[line + 1] - puzzle.first[line]);
+        for (size_t i = 0; same_rules && (i < count); i++)
+        {
+            rule_element_t const &a = image.rule_begin(line)[i];
+            rule_element_t const &b = puzzle.elements[puzzle.first[line] + i];
+            same_rules = (a.color_idx == b.color_idx) && (a.count == b.count);
+        }
+    }
+    failures += check(same_rules, name + ": rules");
+
+    // Each set holds the cache's patterns for its line
+    bool same_sets = (image.nsets() > 0);
+    for (size_t k = 0; k < image.nsets(); k++)
+    {
+        image_set_t const &set = image.set(k);
+        size_t line = set.line;
+        size_t length = (line < puzzle.nrows) ? puzzle.ncols : puzzle.nrows;
+        rule_t rule(image.rule_begin(line), image.rule_end(line));
+        if (set.packed)
+        {
+            shared_ptr<packed_patterns const> bits =
+                cache.packed(rule, length);
+            same_sets = same_sets && (set.count == bits->size()) &&
+                (set.bytes == bits->bit_bytes()) &&
+                (memcmp(image.set_data(k), bits->bits(), set.bytes) == 0);
+        }
+        else
+        {
+            shared_ptr<pattern_set const> patterns =
+                cache.patterns(rule, length);
+            same_sets = same_sets && (set.count == patterns->size()) &&
+                (set.bytes == patterns->offset_bytes()) &&
+                (memcmp(image.set_data(k), patterns->offsets(),
+                        set.bytes) == 0);
+        }
+    }
+    failures += check(same_sets, name + ": pattern sets");
+
+    // Solving the image gives what solving the puzzle does
+    solver from_text;
+    from_text.load(puzzle);
+    from_text.solve();
+    solver from_image;
+    from_image.load(image);
+    result_t result = from_image.solve();
+    failures += check(result.solved &&
+                      (memcmp(from_image.board().cells(),
+                              from_text.board().cells(),
+                              puzzle.ncols * puzzle.nrows *
+                              sizeof(uint32_t)) == 0),
+                      name + ": solution");
+
+    // Images without pattern sets read back too
+    puzzle_image::write(filename.c_str(), puzzle, NULL);
+    image.open(filename.c_str());
+    failures += check(image.nsets() == 0, name + ": no sets");
+    return failures;
+}
+
+// Reject damaged images: cut short, with header, rules or set table
+// corrupted (when opened), or with patterns not fitting the rules (when
+// loaded)
+static int test_damage(puzzle_t const &puzzle, string const &filename,
+                       string const &name)
+{
+    int failures = 0;
+    pattern_cache cache(~(size_t)0);
+    puzzle_image::write(filename.c_str(), puzzle, &cache);
+    vector<char> good = read_file(filename);
+    layout_t parts = layout(good);
+    image_header_t header;
+    memcpy(&header, good.data(), sizeof(header));
+    size_t nlines = header.nrows + header.ncols;
+
+    // Cut short anywhere up to the last set's data (the rest is padding)
+    size_t cuts[] = { 0, 3, sizeof(image_header_t) - 1, parts.first + 4,
+                      parts.elements + 4, parts.sets + 4, good.size() / 2,
+                      good.size() - 8 };
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++)
+    {
+        vector<char> data(good.begin(), good.begin() + cuts[i]);
+        write_file(filename, data);
+        char what[64];
+        snprintf(what, sizeof(what), ": cut to %zu bytes", cuts[i]);
+        failures += check(open_fails(filename), name + what);
+    }
+
+    // Corrupt one field at a time
+    typedef struct
+    {
+        char const *what;
+        size_t offset;
+        uint32_t value;
+        bool on_load; // Only caught when the patterns are taken
+    } damage_t;
+    uint32_t past_end = (uint32_t)good.size();
+    damage_t damage[] =
+    {
+        { "magic", 0, 0x42524f4e, false },
+        { "version", 4, puzzle_image::version + 1, false },
+        { "zero columns", 8, 0, false },
+        { "more rows", 12, header.nrows + 1, false },
+        { "more elements", 16, header.nelements + 1, false },
+        { "more sets", 20, header.nsets + 1000, false },
+        { "first element", parts.first, 1, false },
+        { "last element", parts.first + nlines * 4, header.nelements + 1,
+          false },
+        { "color", parts.elements, 99, false },
+        { "negative count", parts.elements + 4, (uint32_t)-1, false },
+        { "set line", parts.sets, (uint32_t)nlines, false },
+        { "set packing", parts.sets + 4, 2, false },
+        { "set offset", parts.sets + 16, past_end, false },
+        { "set count", parts.sets + 8, 1, true },
+        { "rule count", parts.elements + 4,
+          (uint32_t)puzzle.elements[0].count + 1, true },
+        { "pattern data", past_end - 8, 0xffffffff, true },
+    };
+    for (size_t i = 0; i < sizeof(damage) / sizeof(damage[0]); i++)
+    {
+        vector<char> data = good;
+        memcpy(&data[damage[i].offset], &damage[i].value, sizeof(uint32_t));
+        write_file(filename, data);
+        bool rejected = damage[i].on_load ? load_fails(filename)
+                                          : open_fails(filename);
+        failures += check(rejected, name + ": " + damage[i].what);
+    }
+    return failures;
+}
+
+// Write images of a multicolor puzzle (segment offsets) and a black and
+// white one (pattern bits), read them back, and reject damaged copies
+int main()
+{
+    char filename[] = "/tmp/puzzle_image_testXXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0)
+    {
+        printf("FAIL cannot create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+
+    int failures = 0;
+    puzzle_t puzzle;
+    try
+    {
+        random_puzzle(puzzle, 12, 10, 2, 55, 1);
+        failures += test_round_trip(puzzle, filename, "offsets");
+        failures += test_damage(puzzle, filename, "offsets");
+        random_puzzle(puzzle, 12, 10, 1, 55, 2);
+        failures += test_round_trip(puzzle, filename, "bits");
+        failures += test_damage(puzzle, filename, "bits");
+    }
+    catch (runtime_error const &e)
+    {
+        printf("FAIL %s\n", e.what());
+        failures++;
+    }
+    unlink(filename);
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "colors.h"
+#include "puzzle_reader.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Constructor
+puzzle_reader::puzzle_reader()
+    : data_(NULL), size_(0), mapped_(false), pos_(0), line_(0)
+{
+}
+
+// Destructor
+puzzle_reader::~puzzle_reader()
+{
+    close();
+}
+
+// Open a file (- for stdin), throwing if it can't be read
+void puzzle_reader::open(char const *filename)
+{
+    close();
+    int fd = (strcmp(filename, "-") == 0) ? 0 : ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open file");
+    }
+
+    // Map regular files, and read anything else (or an empty file, which
+    // can't be mapped) in whole
+    struct stat info;
+    if ((fstat(fd, &info) == 0) && S_ISREG(info.st_mode) &&
+        (info.st_size > 0))
+    {
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            data_ = (char const *)data;
+            size_ = info.st_size;
+            mapped_ = true;
+        }
+    }
+    if (!mapped_)
+    {
+        char chunk[1 << 16];
+        ssize_t got;
+        while ((got = read(fd, chunk, sizeof(chunk))) > 0)
+        {
+            buffer_.insert(buffer_.end(), chunk, chunk + got);
+        }
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+    if (fd != 0)
+    {
+        ::close(fd);
+    }
+}
+
+// Read text already in memory instead
+void puzzle_reader::open_text(char const *data, size_t size)
+{
+    close();
+    data_ = data;
+    size_ = size;
+}
+
+// Drop the file
+void puzzle_reader::close()
+{
+    if (mapped_)
+    {
+        munmap((void *)data_, size_);
+    }
+    buffer_.clear();
+    data_ = NULL;
+    size_ = 0;
+    mapped_ = false;
+    pos_ = 0;
+    line_ = 0;
+}
+
+// Read the next puzzle (false if none left), throwing on bad input
+bool puzzle_reader::next(puzzle_t &puzzle)
+{
+    // Skip blank lines after the last puzzle, then take the name from a
+    // delimiter, if any
+    char const *begin;
+    char const *end;
+    size_t start;
+    do
+    {
+        start = pos_;
+        if (!next_line(begin, end))
+        {
+            return false;
+        }
+    } while (blank(begin, end));
+    puzzle.name.clear();
+    if ((end - begin >= 3) && (memcmp(begin, "---", 3) == 0))
+    {
+        while ((begin < end) && (*begin == '-'))
+        {
+            begin++;
+        }
+        while ((begin < end) && blank(begin, begin + 1))
+        {
+            begin++;
+        }
+        while ((end > begin) && blank(end - 1, end))
+        {
+            end--;
+        }
+        puzzle.name.assign(begin, end);
+    }
+    else
+    {
+        // Dimensions, so read that line again
+        pos_ = start;
+        line_--;
+    }
+
+    // Get dimensions
+    read_dims(puzzle);
+
+    // Read row rules, then col rules
+    puzzle.elements.clear();
+    puzzle.first.clear();
+    for (size_t i = 0; i < puzzle.nrows + puzzle.ncols; i++)
+    {
+        puzzle.first.push_back(puzzle.elements.size());
+        read_rule(puzzle);
+    }
+    puzzle.first.push_back(puzzle.elements.size());
+    return true;
+}
+
+// Next line, without its line break (false at end of file)
+bool puzzle_reader::next_line(char const *&begin, char const *&end)
+{
+    if (pos_ >= size_)
+    {
+        return false;
+    }
+    begin = data_ + pos_;
+    end = (char const *)memchr(begin, '\n', size_ - pos_);
+    if (end == NULL)
+    {
+        end = data_ + size_;
+    }
+    pos_ = end - data_ + 1;
+    line_++;
+
+    // Drop the rest of a CRLF line break
+    if ((end > begin) && (end[-1] == '\r'))
+    {
+        end--;
+    }
+    return true;
+}
+
+// Is a line (or part) all spaces?
+bool puzzle_reader::blank(char const *begin, char const *end)
+{
+    char const *token;
+    size_t length;
+    return !next_token(begin, end, token, length);
+}
+
+// Next token of a line, separated by spaces (false at end of line)
+bool puzzle_reader::next_token(char const *&pos, char const *end,
+                               char const *&token, size_t &length)
+{
+    while ((pos < end) && ((*pos == ' ') || (*pos == '\t')))
+    {
+        pos++;
+    }
+    token = pos;
+    while ((pos < end) && (*pos != ' ') && (*pos != '\t'))
+    {
+        pos++;
+    }
+    length = pos - token;
+    return (length > 0);
+}
+
+// Parse a token as an integer (false if it isn't all digits), throwing if
+// it's too large for a count
+bool puzzle_reader::parse_count(char const *token, size_t length, int &value)
+{
+    int parsed = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if ((token[i] < '0') || (token[i] > '9'))
+        {
+            return false;
+        }
+        int digit = token[i] - '0';
+        if (parsed > (INT_MAX - digit) / 10)
+        {
+            bail("Number " + string(token, length) + " is too large");
+        }
+        parsed = parsed * 10 + digit;
+    }
+    value = parsed;
+    return true;
+}
+
+// Read puzzle dimensions
+void puzzle_reader::read_dims(puzzle_t &puzzle)
+{
+    char const *pos;
+    char const *end;
+    if (!next_line(pos, end))
+    {
+        bail("Cannot read from file");
+    }
+
+    // Two positive integers
+    size_t dims[2];
+    size_t ndims = 0;
+    char const *token;
+    size_t length;
+    while (next_token(pos, end, token, length))
+    {
+        int value;
+        if (!parse_count(token, length, value))
+        {
+            bail("Cannot parse " + string(token, length) + " as integer");
+        }
+        if (ndims == 2)
+        {
+            bail("Puzzle must have 2 dimensions");
+        }
+        dims[ndims++] = value;
+    }
+    if (ndims != 2)
+    {
+        bail("Puzzle must have 2 dimensions");
+    }
+    if ((dims[0] == 0) || (dims[1] == 0))
+    {
+        bail("Puzzle dimensions must be positive");
+    }
+
+    // Save results
+    puzzle.ncols = dims[0];
+    puzzle.nrows = dims[1];
+}
+
+// Read row or column rule
+void puzzle_reader::read_rule(puzzle_t &puzzle)
+{
+    char const *pos;
+    char const *end;
+    if (!next_line(pos, end))
+    {
+        bail("Cannot read from file");
+    }
+
+    // Counts, each in the last color named (default black)
+    static int const black = color_table_lookup("K");
+    rule_element_t next;
+    next.color_idx = black;
+    char const *token;
+    size_t length;
+    while (next_token(pos, end, token, length))
+    {
+        // Try parsing as an integer
+        if (parse_count(token, length, next.count))
+        {
+            puzzle.elements.push_back(next);
+        }
+
+        // A color code instead?
+        else if (!color_table_lookup(token, length, next.color_idx))
+        {
+            bail("Unexpected token " + string(token, length));
+        }
+    }
+}
+
+// Stop with an error, naming the line
+void puzzle_reader::bail(string const &msg)
+{
+    char where[32];
+    snprintf(where, sizeof(where), " (line %zu)", line_);
+    throw runtime_error(msg + where);
+}
+
+};
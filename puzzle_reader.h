@@ -0,0 +1,99 @@
+#ifndef PUZZLE_READER_H
+#define PUZZLE_READER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "line_solver.h"
+
+namespace nonogram
+{
+
+// Rules of one puzzle, as flat lists (kept between puzzles, so reading the
+// next one reuses their storage)
+typedef struct
+{
+    std::string name;                     // From the corpus delimiter line
+    size_t ncols;                         // Dimensions
+    size_t nrows;
+    std::vector<rule_element_t> elements; // Rule elements, rows then columns
+    std::vector<size_t> first;            // Each line's first element, and
+                                          // one past the last line's
+} puzzle_t;
+
+// Reader for puzzle files
+//
+// A file holds one puzzle (dimensions, then a line for each row rule and
+// each column rule), or a corpus of any number of them, each after a
+// delimiter line of "---" and an optional name. The file is memory mapped
+// (or read whole, when it can't be, like a pipe) and tokenized in place,
+// so reading a puzzle allocates nothing once the puzzle_t it fills is big
+// enough.
+class puzzle_reader
+{
+public:
+
+    // Constructor
+    puzzle_reader();
+
+    // Destructor
+    ~puzzle_reader();
+
+    // Open a file (- for stdin), throwing if it can't be read
+    void open(char const *filename);
+
+    // Read text already in memory instead (not copied, so it must outlive
+    // the reading)
+    void open_text(char const *data, size_t size);
+
+    // Drop the file
+    void close();
+
+    // Read the next puzzle (false if none left), throwing on bad input
+    bool next(puzzle_t &puzzle);
+
+    // Line of the file last read (from 1)
+    size_t line_number() const { return line_; }
+
+private:
+
+    // Not copyable
+    puzzle_reader(puzzle_reader const &);
+    puzzle_reader &operator=(puzzle_reader const &);
+
+    // Next line, without its line break (false at end of file)
+    bool next_line(char const *&begin, char const *&end);
+
+    // Is a line (or part) all spaces?
+    static bool blank(char const *begin, char const *end);
+
+    // Next token of a line, separated by spaces (false at end of line)
+    static bool next_token(char const *&pos, char const *end,
+                           char const *&token, size_t &length);
+
+    // Parse a token as an integer (false if it isn't all digits),
+    // throwing if it's too large for a count
+    bool parse_count(char const *token, size_t length, int &value);
+
+    // Read puzzle dimensions
+    void read_dims(puzzle_t &puzzle);
+
+    // Read row or column rule
+    void read_rule(puzzle_t &puzzle);
+
+    // Stop with an error, naming the line
+    void bail(std::string const &msg);
+
+    // File contents, whether mapped (or copied into buffer_, or neither
+    // for text in memory), and position
+    char const *data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> buffer_;
+    size_t pos_;
+    size_t line_;
+};
+
+};
+
+#endif
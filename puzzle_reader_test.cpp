@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "colors.h"
+#include "puzzle_reader.h"
+using namespace std;
+using namespace nonogram;
+
+// Count a failed check, naming it
+static int check(bool ok, char const *what)
+{
+    if (!ok)
+    {
+        printf("FAIL %s\n", what);
+    }
+    return ok ? 0 : 1;
+}
+
+// Does a puzzle have these dimensions, and this rule (as counts, with the
+// color of each) for its first line?
+static bool shaped(puzzle_t const &puzzle, size_t ncols, size_t nrows,
+                   size_t nelements, int first_count, char const *color)
+{
+    return (puzzle.ncols == ncols) && (puzzle.nrows == nrows) &&
+           (puzzle.first.size() == ncols + nrows + 1) &&
+           (puzzle.elements.size() == nelements) &&
+           (puzzle.first[ncols + nrows] == nelements) &&
+           (nelements > 0) && (puzzle.elements[0].count == first_count) &&
+           (puzzle.elements[0].color_idx == color_table_lookup(color));
+}
+
+// Does reading every puzzle of text fail, with message in the error?
+static bool rejects(char const *text, char const *message)
+{
+    puzzle_reader reader;
+    puzzle_t puzzle;
+    reader.open_text(text, strlen(text));
+    try
+    {
+        while (reader.next(puzzle))
+        {
+        }
+    }
+    catch (runtime_error const &e)
+    {
+        if (strstr(e.what(), message) == NULL)
+        {
+            printf("     error was: %s\n", e.what());
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Read a corpus: delimiters with and without names, blank lines between
+// puzzles, and CRLF line breaks
+static int test_corpus()
+{
+    static char const text[] =
+        "--- first\n"
+        "2 1\n"
+        "2\n"
+        "1\n"
+        "1\n"
+        "\n"
+        "---   second one  \r\n"
+        "1 2\r\n"
+        "R 1\r\n"
+        "R 1\r\n"
+        "R 2\r\n"
+        "---\n"
+        "1 1\n"
+        "\n"
+        "0\n"
+        "\n\n";
+
+    int failures = 0;
+    puzzle_reader reader;
+    puzzle_t puzzle;
+    reader.open_text(text, sizeof(text) - 1);
+
+    failures += check(reader.next(puzzle), "corpus: first puzzle read");
+    failures += check(puzzle.name == "first", "corpus: first name");
+    failures += check(shaped(puzzle, 2, 1, 3, 2, "K"),
+                      "corpus: first rules");
+
+    failures += check(reader.next(puzzle), "corpus: second puzzle read");
+    failures += check(puzzle.name == "second one", "corpus: second name");
+    failures += check(shaped(puzzle, 1, 2, 3, 1, "R"),
+                      "corpus: second rules");
+
+    failures += check(reader.next(puzzle), "corpus: third puzzle read");
+    failures += check(puzzle.name.empty(), "corpus: third name");
+    failures += check((puzzle.ncols == 1) && (puzzle.nrows == 1) &&
+                      (puzzle.first.size() == 3) &&
+                      (puzzle.first[1] == 0) && (puzzle.first[2] == 1),
+                      "corpus: third rules");
+
+    failures += check(!reader.next(puzzle), "corpus: nothing after");
+    return failures;
+}
+
+// Read a single puzzle, with no delimiter
+static int test_single()
+{
+    static char const text[] = "1 1\n1\n1\n";
+    int failures = 0;
+    puzzle_reader reader;
+    puzzle_t puzzle;
+    puzzle.name = "stale";
+    reader.open_text(text, sizeof(text) - 1);
+    failures += check(reader.next(puzzle), "single: read");
+    failures += check(puzzle.name.empty(), "single: no name");
+    failures += check(shaped(puzzle, 1, 1, 2, 1, "K"), "single: rules");
+    failures += check(!reader.next(puzzle), "single: nothing after");
+    return failures;
+}
+
+// Reject bad input, naming the line: counts and dimensions too large for
+// an int, and malformed puzzles
+static int test_errors()
+{
+    int failures = 0;
+    failures += check(rejects("1 1\n1\n99999999999\n",
+                              "Number 99999999999 is too large (line 3)"),
+                      "errors: count overflow");
+    failures += check(rejects("1 1\n1\n2147483648\n", "too large"),
+                      "errors: count just past INT_MAX");
+    failures += check(rejects("99999999999 1\n1\n1\n",
+                              "Number 99999999999 is too large (line 1)"),
+                      "errors: dimension overflow");
+    failures += check(rejects("--- big\n1 4294967297\n", "too large"),
+                      "errors: dimension past 32 bits");
+    failures += check(rejects("1\n1\n", "must have 2 dimensions"),
+                      "errors: one dimension");
+    failures += check(rejects("1 1 1\n1\n1\n", "must have 2 dimensions"),
+                      "errors: three dimensions");
+    failures += check(rejects("0 1\n1\n", "must be positive"),
+                      "errors: zero dimension");
+    failures += check(rejects("1 x\n1\n1\n", "Cannot parse x"),
+                      "errors: dimension not a number");
+    failures += check(rejects("1 1\n1\nQ 1\n", "Unexpected token Q (line 3)"),
+                      "errors: unknown color");
+    failures += check(rejects("1 2\n1\n1\n", "Cannot read from file"),
+                      "errors: rules missing");
+    failures += check(rejects("---\n", "Cannot read from file"),
+                      "errors: delimiter alone");
+    return failures;
+}
+
+// Read corpora and single puzzles, and reject bad ones
+int main()
+{
+    int failures = test_corpus() + test_single() + test_errors();
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,724 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "json.h"
+#include "solver.h"
+#include "tools.h"
+using namespace std;
+using namespace nonogram;
+
+// Longest request line accepted
+static size_t const max_line = 16 << 20;
+
+// Largest count or limit taken from a request (doubles hold every whole
+// number up to here exactly)
+static double const max_count = 1e15;
+
+// Socket to remove on exit (NULL when serving stdin and stdout)
+static char const *socket_path = NULL;
+
+// Show command line usage
+static void usage(char const *name)
+{
+    cerr << "Usage: " << name << " [-S socket] [-e patterns|dp]"
+         << " [-b first|fewest|cells] [-p seconds] [-w] [-d seconds]"
+         << " [-j threads] [-q jobs] [-m MB] [-t entries]" << endl;
+    cerr << "  -S  Listen on a UNIX domain socket (default JSON lines on"
+         << " stdin and stdout)" << endl;
+    cerr << "  -e  Line solving engine, unless a request picks one (default"
+         << " patterns)" << endl;
+    cerr << "  -b  Branching strategy for guesses (default first)" << endl;
+    cerr << "  -p  Time to spend probing cells before each guess (default 0,"
+         << " none)" << endl;
+    cerr << "  -w  Search the whole puzzle as one, without splitting off"
+         << " independent parts" << endl;
+    cerr << "  -d  Seconds allowed per request, unless it sets a deadline"
+         << " (default 0, no limit)" << endl;
+    cerr << "  -j  Worker threads (default one per core)" << endl;
+    cerr << "  -q  Requests queued before reading more waits (default 64)"
+         << endl;
+    cerr << "  -m  Pattern cache size, shared by all requests (default "
+         << (pattern_cache::default_max_bytes >> 20) << ")" << endl;
+    cerr << "  -t  Line memo entries per solver, 0 for none (default "
+         << solver::default_memo_slots << ")" << endl;
+    cerr << "Each request is a JSON object on one line, with an optional id,"
+         << " and either" << endl;
+    cerr << "  \"puzzle\": text of a puzzle file, or" << endl;
+    cerr << "  \"rows\", \"cols\": rules, as arrays of counts (black) or"
+         << " [count, \"color\"] pairs" << endl;
+    cerr << "and optionally \"engine\", \"solutions\" (limit, listing the"
+         << " first two found), \"deadline\""
+         << " (seconds from receipt) and \"guesses\"" << endl;
+    cerr << "A request of {\"command\": \"stats\"} reports on the server"
+         << endl;
+    exit(1);
+}
+
+// Client connection, closed once its reader and every response are done
+struct connection_t
+{
+    connection_t(int in, int out) : in(in), out(out) {}
+    ~connection_t()
+    {
+        if (socket_path)
+        {
+            close(in);
+        }
+    }
+
+    int in;
+    int out;
+    mutex lock; // Held while writing a response
+};
+
+// Send a response line (a client that went away just misses it)
+static void respond(connection_t &conn, string line)
+{
+    line += '\n';
+    lock_guard<mutex> guard(conn.lock);
+    size_t done = 0;
+    while (done < line.size())
+    {
+        ssize_t sent = write(conn.out, line.data() + done, line.size() - done);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        done += sent;
+    }
+}
+
+// Puzzle waiting to be solved, and how to answer
+typedef struct
+{
+    shared_ptr<connection_t> conn;
+    string id;                    // Request id as JSON (empty for none)
+    puzzle_t puzzle;
+    engine_t engine;
+    size_t solution_limit;
+    limits_t limits;              // Seconds counted from receipt
+    chrono::steady_clock::time_point received;
+} job_t;
+
+// Shared by all connections and workers: requests waiting (up to a limit,
+// past which readers wait for room, so clients see backpressure), the
+// pattern cache kept warm between requests, and counters
+typedef struct
+{
+    mutex lock;
+    condition_variable ready;
+    condition_variable room;
+    deque<job_t> jobs;
+    size_t max_jobs;
+    bool closed;
+
+    pattern_cache *cache;
+    unsigned workers;
+    atomic<unsigned long> received;
+    atomic<unsigned long> solved;
+} server_t;
+
+// Queue a job, waiting for room
+static void push_job(server_t &server, job_t &job)
+{
+    unique_lock<mutex> guard(server.lock);
+    server.room.wait(guard, [&]()
+    {
+        return server.jobs.size() < server.max_jobs;
+    });
+    server.jobs.push_back(job_t());
+    swap(server.jobs.back(), job);
+    server.ready.notify_one();
+}
+
+// Take the next job, waiting for one (false once closed and drained)
+static bool pop_job(server_t &server, job_t &job)
+{
+    unique_lock<mutex> guard(server.lock);
+    server.ready.wait(guard, [&]()
+    {
+        return !server.jobs.empty() || server.closed;
+    });
+    if (server.jobs.empty())
+    {
+        return false;
+    }
+    swap(job, server.jobs.front());
+    server.jobs.pop_front();
+    server.room.notify_one();
+    return true;
+}
+
+// No more jobs coming
+static void close_jobs(server_t &server)
+{
+    lock_guard<mutex> guard(server.lock);
+    server.closed = true;
+    server.ready.notify_all();
+}
+
+// Whole number from a request, throwing unless it's one from low to high
+static double whole_number(json_t const &value, double low, double high,
+                           char const *what)
+{
+    if ((value.type != json_t::JSON_NUMBER) ||
+        !((value.number >= low) && (value.number <= high)) ||
+        (value.number != floor(value.number)))
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%s must be whole numbers from %.0f to"
+                 " %.0f", what, low, high);
+        throw runtime_error(buf);
+    }
+    return value.number;
+}
+
+// Rules given as JSON arrays, one per row then column
+static void read_json_rules(json_t const &rows, json_t const &cols,
+                            puzzle_t &puzzle)
+{
+    if ((rows.type != json_t::JSON_ARRAY) ||
+        (cols.type != json_t::JSON_ARRAY))
+    {
+        throw runtime_error("Rows and columns must be arrays");
+    }
+
+    puzzle_builder build(puzzle, cols.items.size(), rows.items.size());
+    for (size_t line = 0; line < rows.items.size() + cols.items.size();
+         line++)
+    {
+        json_t const &rule = (line < rows.items.size())
+                             ? rows.items[line]
+                             : cols.items[line - rows.items.size()];
+        if (rule.type != json_t::JSON_ARRAY)
+        {
+            throw runtime_error("Each rule must be an array");
+        }
+
+        // Counts in black, or [count, color] pairs
+        build.next_rule();
+        for (size_t i = 0; i < rule.items.size(); i++)
+        {
+            json_t const &item = rule.items[i];
+            if (item.type == json_t::JSON_NUMBER)
+            {
+                build.segment((int)whole_number(item, 0, INT_MAX,
+                                                "Segment counts"));
+            }
+            else if ((item.type == json_t::JSON_ARRAY) &&
+                     (item.items.size() == 2) &&
+                     (item.items[0].type == json_t::JSON_NUMBER) &&
+                     (item.items[1].type == json_t::JSON_STRING))
+            {
+                build.segment((int)whole_number(item.items[0], 0, INT_MAX,
+                                                "Segment counts"),
+                              item.items[1].text.c_str());
+            }
+            else
+            {
+                throw runtime_error("Rule segments must be counts or"
+                                    " [count, color] pairs");
+            }
+        }
+    }
+}
+
+// Turn a request line into a job, throwing if it doesn't make sense
+static void read_request(json_t const &request, job_t &job)
+{
+    // Puzzle text, as in a puzzle file, or rules as arrays
+    json_t const *text = json_member(request, "puzzle");
+    json_t const *rows = json_member(request, "rows");
+    json_t const *cols = json_member(request, "cols");
+    if (text && (text->type == json_t::JSON_STRING))
+    {
+        puzzle_reader reader;
+        reader.open_text(text->text.data(), text->text.size());
+        if (!reader.next(job.puzzle))
+        {
+            throw runtime_error("No puzzle in text");
+        }
+    }
+    else if (rows && cols)
+    {
+        read_json_rules(*rows, *cols, job.puzzle);
+    }
+    else
+    {
+        throw runtime_error("Request needs a puzzle, or rows and cols");
+    }
+
+    // Options
+    json_t const *engine = json_member(request, "engine");
+    if (engine)
+    {
+        if ((engine->type != json_t::JSON_STRING) ||
+            !engine_named(engine->text.c_str(), job.engine))
+        {
+            throw runtime_error("Engine must be patterns or dp");
+        }
+    }
+    json_t const *solutions = json_member(request, "solutions");
+    if (solutions)
+    {
+        job.solution_limit = (size_t)whole_number(*solutions, 1, max_count,
+                                                  "Solution limits");
+    }
+    json_t const *deadline = json_member(request, "deadline");
+    if (deadline)
+    {
+        if ((deadline->type != json_t::JSON_NUMBER) ||
+            !((deadline->number >= 0) && (deadline->number <= max_count)))
+        {
+            throw runtime_error("Deadline must be a number of seconds");
+        }
+        job.limits.seconds = deadline->number;
+    }
+    json_t const *guesses = json_member(request, "guesses");
+    if (guesses)
+    {
+        job.limits.guesses = (unsigned long)whole_number(*guesses, 0,
+                                                         max_count,
+                                                         "Guess budgets");
+    }
+}
+
+// Start a response with the request id, if any
+static string start_response(string const &id)
+{
+    return id.empty() ? string("{") : "{\"id\":" + id + ",";
+}
+
+// Report on the server
+static string stats_response(server_t &server, string const &id)
+{
+    size_t queued;
+    {
+        lock_guard<mutex> guard(server.lock);
+        queued = server.jobs.size();
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "\"status\":\"ok\",\"workers\":%u,\"queued\":%zu"
+             ",\"max_queued\":%zu,\"received\":%lu,\"solved\":%lu"
+             ",\"cache_hits\":%lu,\"cache_misses\":%lu,\"cache_bytes\":%zu}",
+             server.workers, queued, server.max_jobs,
+             (unsigned long)server.received, (unsigned long)server.solved,
+             server.cache->hits(), server.cache->misses(),
+             server.cache->bytes());
+    return start_response(id) + buf;
+}
+
+// Read requests from a connection until it closes, queueing puzzles and
+// answering anything else straight away
+static void serve_connection(server_t &server, shared_ptr<connection_t> conn,
+                             job_t const &defaults)
+{
+    vector<char> buffer;
+    size_t scanned = 0;
+    char chunk[1 << 16];
+    while (true)
+    {
+        // Next line, if a whole one has arrived
+        char const *begin = buffer.data();
+        char const *newline = (char const *)memchr(begin + scanned, '\n',
+                                                   buffer.size() - scanned);
+        if (newline == NULL)
+        {
+            scanned = buffer.size();
+            ssize_t got = read(conn->in, chunk, sizeof(chunk));
+            if ((got < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if ((got == 0) && !buffer.empty())
+            {
+                // Last line, without a line break
+                buffer.push_back('\n');
+                continue;
+            }
+            if (got <= 0)
+            {
+                break;
+            }
+            if (buffer.size() + got > max_line)
+            {
+                respond(*conn, "{\"status\":\"error\",\"error\":"
+                               "\"Request too long\"}");
+                break;
+            }
+            buffer.insert(buffer.end(), chunk, chunk + got);
+            continue;
+        }
+        json_t request;
+        char const *pos = begin;
+        bool parsed = json_parse(pos, newline, request);
+        json_space(pos, newline);
+        bool blank = (newline == begin + strspn(begin, " \t\r"));
+        buffer.erase(buffer.begin(), buffer.begin() + (newline - begin) + 1);
+        scanned = 0;
+        if (blank)
+        {
+            continue;
+        }
+
+        // Id to echo, as JSON
+        job_t job = defaults;
+        job.conn = conn;
+        job.received = chrono::steady_clock::now();
+        json_t const *id = parsed ? json_member(request, "id") : NULL;
+        if (id && (id->type == json_t::JSON_STRING))
+        {
+            job.id = json_string(id->text);
+        }
+        else if (id && (id->type == json_t::JSON_NUMBER))
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.15g", id->number);
+            job.id = buf;
+        }
+
+        try
+        {
+            if (!parsed || (pos != newline) ||
+                (request.type != json_t::JSON_OBJECT))
+            {
+                throw runtime_error("Request must be a JSON object");
+            }
+            json_t const *command = json_member(request, "command");
+            if (command && (command->type == json_t::JSON_STRING) &&
+                (command->text == "stats"))
+            {
+                respond(*conn, stats_response(server, job.id));
+                continue;
+            }
+            if (command && ((command->type != json_t::JSON_STRING) ||
+                            (command->text != "solve")))
+            {
+                throw runtime_error("Unknown command");
+            }
+            read_request(request, job);
+        }
+        catch (exception &e)
+        {
+            respond(*conn, start_response(job.id) +
+                           "\"status\":\"error\",\"error\":" +
+                           json_string(e.what()) + "}");
+            continue;
+        }
+        server.received++;
+        push_job(server, job);
+    }
+}
+
+// Solve one job with a worker's solver, and format the response
+static string solve_job(solver &app, job_t &job)
+{
+    string line = start_response(job.id);
+    char buf[256];
+
+    // Time spent queued, and loading, counts against the deadline
+    chrono::duration<double> waited = chrono::steady_clock::now() -
+                                      job.received;
+    if ((job.limits.seconds > 0) && (waited.count() >= job.limits.seconds))
+    {
+        snprintf(buf, sizeof(buf),
+                 "\"status\":\"timeout\",\"complete\":0.0"
+                 ",\"seconds\":0.000000,\"wait\":%.6f}", waited.count());
+        return line + buf;
+    }
+    limits_t limits = job.limits;
+    if (limits.seconds > 0)
+    {
+        limits.seconds = max(limits.seconds - waited.count(), 1e-9);
+    }
+    app.set_solution_limit(job.solution_limit);
+    app.set_limits(limits);
+    if (!app.reset(job.puzzle, job.engine))
+    {
+        return line + "\"status\":\"error\",\"error\":" +
+               json_string(app.error()) + "}";
+    }
+    result_t result = app.solve();
+
+    char const *status = result.solved ? "solved" : "unsolved";
+    if (result.status == STATUS_TIMEOUT)
+    {
+        status = "timeout";
+    }
+    snprintf(buf, sizeof(buf),
+             "\"status\":\"%s\",\"engine\":\"%s\",\"complete\":%.1f"
+             ",\"seconds\":%.6f,\"wait\":%.6f,\"guesses\":%lu"
+             ",\"solutions\":%zu",
+             status, engine_name(app.engine()), result.complete,
+             result.seconds, waited.count(), result.guesses,
+             result.solutions);
+    line += buf;
+
+    // Board as rows of color indexes (-1 for cells not solved), and when
+    // counting, the first two solutions found, to show one isn't unique
+    line += ",\"board\":" + board_json(app.board());
+    if (app.solution(0))
+    {
+        line += ",\"solution_boards\":" + solutions_json(app);
+    }
+    return line + "}";
+}
+
+// Take jobs until there are no more
+static void work(server_t &server, solver &app)
+{
+    job_t job;
+    while (pop_job(server, job))
+    {
+        string line = solve_job(app, job);
+        server.solved++;
+        respond(*job.conn, line);
+        job.conn.reset();
+    }
+}
+
+// Remove the socket and stop
+static void on_stop(int)
+{
+    if (socket_path)
+    {
+        unlink(socket_path);
+    }
+    _exit(0);
+}
+
+// Listen on a UNIX domain socket, serving each client on a thread of its
+// own (never returns)
+static void listen_socket(server_t &server, job_t const &defaults)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        cerr << "Socket path too long" << endl;
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if ((fd < 0) || (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(fd, 16) != 0))
+    {
+        cerr << "Cannot listen on " << socket_path << ": "
+             << strerror(errno) << endl;
+        exit(1);
+    }
+    signal(SIGINT, on_stop);
+    signal(SIGTERM, on_stop);
+
+    while (true)
+    {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+        shared_ptr<connection_t> conn =
+            make_shared<connection_t>(client, client);
+        thread(serve_connection, ref(server), conn, cref(defaults)).detach();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    branch_t branching = BRANCH_FIRST;
+    double probe_seconds = 0;
+    bool decompose = true;
+    unsigned nthreads = thread::hardware_concurrency();
+    size_t max_jobs = 64;
+    size_t cache_bytes = pattern_cache::default_max_bytes;
+    size_t memo_slots = solver::default_memo_slots;
+    job_t defaults;
+    defaults.engine = ENGINE_PATTERNS;
+    defaults.solution_limit = 1;
+    limits_t none = { 0, 0, NULL };
+    defaults.limits = none;
+    unsigned long number;
+
+    // Parse command line
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-S") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            socket_path = argv[i];
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!engine_named(argv[i], defaults.engine))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!branching_named(argv[i], branching))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            probe_seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            decompose = false;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            defaults.limits.seconds = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, max_threads, number))
+            {
+                usage(argv[0]);
+            }
+            nthreads = number;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 1, UINT32_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            max_jobs = number;
+        }
+        else if (strcmp(argv[i], "-m") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, SIZE_MAX >> 20, number))
+            {
+                usage(argv[0]);
+            }
+            cache_bytes = (size_t)number << 20;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            if (++i == argc)
+            {
+                usage(argv[0]);
+            }
+            if (!option_number(argv[i], 0, UINT32_MAX, number))
+            {
+                usage(argv[0]);
+            }
+            memo_slots = number;
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (nthreads == 0)
+    {
+        nthreads = 1;
+    }
+    if (max_jobs == 0)
+    {
+        max_jobs = 1;
+    }
+
+    // Clients that hang up early shouldn't take the server with them
+    signal(SIGPIPE, SIG_IGN);
+
+    // Workers, each with a solver kept between requests, sharing one
+    // pattern cache
+    pattern_cache cache(cache_bytes);
+    server_t server;
+    server.max_jobs = max_jobs;
+    server.closed = false;
+    server.cache = &cache;
+    server.workers = nthreads;
+    server.received = 0;
+    server.solved = 0;
+    vector<thread> workers;
+    for (unsigned t = 0; t < nthreads; t++)
+    {
+        workers.push_back(thread([&]()
+        {
+            solver app;
+            app.set_cache(&cache);
+            app.set_memo_size(memo_slots);
+            app.set_branching(branching);
+            app.set_probing(probe_seconds);
+            app.set_decomposition(decompose);
+            work(server, app);
+        }));
+    }
+
+    // Serve a socket forever, or stdin until it ends
+    if (socket_path)
+    {
+        listen_socket(server, defaults);
+    }
+    serve_connection(server, make_shared<connection_t>(0, 1), defaults);
+    close_jobs(server);
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+
+    return 0;
+}
@@ -1,26 +1,198 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <fstream>
+#include <mutex>
 #include "solver.h"
 #include "colors.h"
 using namespace std;
 using namespace nonogram;
 
+// Swap a container for an empty one drawing on mem
+template <typename T>
+static void renew(T &storage, arena &mem)
+{
+    T(&mem).swap(storage);
+}
+
+// Number each line's patterns, with each line's ids following the last
+static void number_patterns(arena_vector<size_t> const &counts,
+                            arena_vector<uint32_t> &ids,
+                            arena_vector<size_t> &first)
+{
+    size_t total = 0;
+    first.resize(counts.size());
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        first[i] = total;
+        total += counts[i];
+    }
+
+    ids.resize(total);
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        for (size_t id = 0; id < counts[i]; id++)
+        {
+            ids[first[i] + id] = id;
+        }
+    }
+}
+
+// Constructor (load a puzzle later)
+solver::solver()
+    : engine_(ENGINE_PATTERNS), observer_(NULL), pool_(NULL), cancel_(NULL),
+      cache_(NULL), dirty_head_(0), dirty_count_(0), nrows_(0), ncols_(0),
+      loaded_(false), load_stopped_(false), memo_slots_(default_memo_slots),
+      pattern_budget_(default_pattern_budget), solved_cells_(0),
+      guess_depth_(0),
+      branching_(BRANCH_FIRST), probe_seconds_(0), probe_serial_(0),
+      decompose_(true), focus_(0), next_focus_(1), split_solved_(0),
+      solution_limit_(1), solutions_(0), stop_(new stop_state_t()),
+      stop_checks_(0), guesses_(0), memo_hits_(0), memo_misses_(0),
+      probes_(0), components_(0)
+{
+    limits_t none = { 0, 0, NULL };
+    limits_ = none;
+}
+
 // Constructor
-solver::solver(char const *filename)
-    : solved_cells_(0)
+solver::solver(char const *filename, engine_t engine)
+    : engine_(engine), observer_(NULL), pool_(NULL), cancel_(NULL),
+      cache_(NULL), dirty_head_(0), dirty_count_(0), nrows_(0), ncols_(0),
+      loaded_(false), load_stopped_(false), memo_slots_(default_memo_slots),
+      pattern_budget_(default_pattern_budget), solved_cells_(0),
+      guess_depth_(0),
+      branching_(BRANCH_FIRST), probe_seconds_(0), probe_serial_(0),
+      decompose_(true), focus_(0), next_focus_(1), split_solved_(0),
+      solution_limit_(1), solutions_(0), stop_(new stop_state_t()),
+      stop_checks_(0), guesses_(0), memo_hits_(0), memo_misses_(0),
+      probes_(0), components_(0)
+{
+    limits_t none = { 0, 0, NULL };
+    limits_ = none;
+    load(filename, engine);
+}
+
+// Load a puzzle, reusing storage from any previous one
+void solver::load(char const *filename, engine_t engine)
+{
+    // Binary images are mapped rather than read
+    if (puzzle_image::recognize(filename))
+    {
+        puzzle_image image;
+        image.open(filename);
+        load(image, engine);
+        return;
+    }
+
+    start_load(engine);
+    puzzle_t puzzle;
+    {
+        PROFILE_STAGE(profile_, STAGE_PARSE);
+        puzzle_reader reader;
+        reader.open(filename);
+        if (!reader.next(puzzle))
+        {
+            bail("Cannot read from file");
+        }
+    }
+    finish_load(puzzle);
+}
+
+// Load a puzzle already read, reusing storage from any previous one
+void solver::load(puzzle_t const &puzzle, engine_t engine)
+{
+    start_load(engine);
+    finish_load(puzzle);
+}
+
+// Load a puzzle from memory, reusing storage from any previous one
+bool solver::reset(puzzle_t const &puzzle, engine_t engine)
+{
+    error_.clear();
+    try
+    {
+        load(puzzle, engine);
+    }
+    catch (exception &e)
+    {
+        error_ = e.what();
+        loaded_ = false;
+        return false;
+    }
+    return true;
+}
+
+// Load a puzzle image, reusing storage from any previous one
+void solver::load(puzzle_image const &image, engine_t engine)
+{
+    start_load(engine);
+    {
+        PROFILE_STAGE(profile_, STAGE_PARSE);
+        read_all_rules(image);
+        number_rules();
+    }
+    prepare(&image);
+}
+
+// Drop previous puzzle, then recycle its storage
+void solver::start_load(engine_t engine)
+{
+    renew_storage();
+    arena_.reset();
+    engine_ = engine;
+    loaded_ = false;
+    load_stopped_ = false;
+    load_start_ = chrono::steady_clock::now();
+    start_limits();
+    cancel_ = NULL;
+    solved_cells_ = 0;
+    guess_depth_ = 0;
+    guesses_ = 0;
+    memo_hits_ = 0;
+    memo_misses_ = 0;
+    probes_ = 0;
+    components_ = 0;
+    PROFILE_COUNT(profile_.reset());
+}
+
+// Take rules, check them, and set up the board
+void solver::finish_load(puzzle_t const &puzzle)
+{
+    // Copy rules, and run sanity checks
+    {
+        PROFILE_STAGE(profile_, STAGE_PARSE);
+        read_all_rules(puzzle);
+        sanity();
+        number_rules();
+    }
+    prepare(NULL);
+}
+
+// Pick the engine, get patterns, and set up the board
+void solver::prepare(puzzle_image const *image)
 {
-    // Read board dimensions
-    read_all_rules(filename);
+    PROFILE_COUNT(profile_.set_lines(nrows_ + ncols_));
 
-    // Run sanity checks
-    sanity();
+    // Puzzles with too many placements to list are left to DP, and black
+    // and white ones can use packed patterns
+    if ((engine_ == ENGINE_PATTERNS) && over_pattern_budget())
+    {
+        engine_ = ENGINE_DP;
+    }
+    else if ((engine_ == ENGINE_PATTERNS) && black_and_white())
+    {
+        engine_ = ENGINE_BITS;
+    }
 
     // Generate possible segment patterns
-    generate_all_patterns();
+    generate_all_patterns(image);
 
     // Set up board
     setup_board();
+    loaded_ = true;
 }
 
 // Run sanity checks
@@ -29,10 +201,6 @@ void solver::sanity()
     unsigned i, j;
     vector<int> tally;
     tally.resize(color_table_size);
-    for (i = 0; i < tally.size(); i++)
-    {
-        tally[i];
-    }
 
     // Add up all colors in rows
     for (i = 0; i < row_rules_.size(); i++)
@@ -61,36 +229,198 @@ void solver::sanity()
     {
         if (tally[i] != 0)
         {
-            printf("Color row/col imbalance - Not solvable\n");
-            exit(1);
+            bail("Color row/col imbalance - Not solvable");
+        }
+    }
+}
+
+// Do all rules use black (K) only?
+bool solver::black_and_white()
+{
+    int black = color_table_lookup("K");
+    for (size_t i = 0; i < row_rules_.size(); i++)
+    {
+        for (size_t j = 0; j < row_rules_[i].size(); j++)
+        {
+            if (row_rules_[i][j].color_idx != black)
+            {
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < col_rules_.size(); i++)
+    {
+        for (size_t j = 0; j < col_rules_[i].size(); j++)
+        {
+            if (col_rules_[i][j].color_idx != black)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Would listing every line's placements take more patterns than the
+// budget allows?
+bool solver::over_pattern_budget() const
+{
+    if (pattern_budget_ == 0)
+    {
+        return false;
+    }
+
+    // Counted without generating, stopping once over
+    size_t total = 0;
+    for (size_t line = 0; line < nrows_ + ncols_; line++)
+    {
+        bool row = (line < nrows_);
+        total += pattern_set::placements(
+            row ? row_rules_[line] : col_rules_[line - nrows_],
+            row ? ncols_ : nrows_, pattern_budget_ - total);
+        if (total > pattern_budget_)
+        {
+            return true;
         }
     }
+    return false;
 }
 
 // Run solver
 bool solver::run()
 {
-    size_t old_count;
+    PROFILE_STAGE(profile_, STAGE_SEARCH);
+
+    // Out of time or guesses?
+    if (check_limits())
+    {
+        return false;
+    }
 
-    // Keep going if we're progressing
-    do
+    // Work through lines until nothing else changes
+    if (!propagate())
     {
-        // Save for later
-        old_count = solved_cells_;
+        return false;
+    }
+
+    // Settle what we can by probing each color of each cell
+    if ((probe_seconds_ > 0) && !focus_solved() && !probe())
+    {
+        return false;
+    }
 
-        // Do a pass
-        apply_row_patterns();
-        apply_col_patterns();
+    // Found a solution?
+    if (focus_solved())
+    {
+        return found_solution();
+    }
 
-        // Need to make a guess?
-        if (old_count == solved_cells_)
+    // Need to make a guess? Parts of the puzzle that no longer constrain
+    // each other can be searched one after another, rather than as one
+    //
+    // Looking for them costs about a pass over every line, so only look
+    // again once a good share of the cells left has been solved since the
+    // last look found nothing
+    size_t first = next_focus_;
+    size_t count = 1;
+    if (decompose_ && (solved_cells_ >= split_solved_))
+    {
+        count = find_components();
+        if (count < 2)
         {
-            make_a_guess();
+            size_t left = nrows_ * ncols_ - solved_cells_;
+            split_solved_ = solved_cells_ +
+                            max(max(nrows_, ncols_), left / split_share);
         }
+    }
+    if (count > 1)
+    {
+        return solve_components(first, count);
+    }
+    make_a_guess();
+
+    return counting() ? (solutions_ >= solution_limit_) : focus_solved();
+}
+
+// Note a solution of the cells in focus, keeping the first two when
+// counting (true if that's enough solutions)
+bool solver::found_solution()
+{
+    if (!counting())
+    {
+        return true;
+    }
+    if (solutions_ < 2)
+    {
+        copy(board_.begin(), board_.end(),
+             solution_cells_.begin() + solutions_ * board_.size());
+    }
+    solutions_++;
+    return (solutions_ >= solution_limit_);
+}
+
+// Run solver, and time it
+result_t solver::solve()
+{
+    result_t result = result_t();
+    if (!loaded_)
+    {
+        result.status = STATUS_INVALID;
+        return result;
+    }
+
+    // Limits stopped loading, so there are no patterns to go on
+    if (load_stopped_)
+    {
+        result.status = STATUS_TIMEOUT;
+        result.complete = percent_complete();
+        return result;
+    }
 
-    } while (old_count != solved_cells_);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    start_limits();
+    solutions_ = 0;
+    if (counting())
+    {
+        // Search everything (up to the limit), then show the first found
+        solution_cells_.resize(2 * board_.size());
+        run();
+        if (solutions_ > 0)
+        {
+            for (size_t i = 0; i < board_.size(); i++)
+            {
+                store_cell(i / ncols_, i % ncols_, solution_cells_[i]);
+            }
+        }
+        result.solved = (solutions_ > 0);
+        result.solutions = solutions_;
+    }
+    else
+    {
+        result.solved = run();
+        result.solutions = result.solved ? 1 : 0;
+    }
 
-    return is_solved();
+    // Stopping early leaves the board as far as deduced before the first
+    // guess (or the first solution found, when counting)
+    if (cancelled())
+    {
+        result.status = STATUS_TIMEOUT;
+    }
+    else
+    {
+        result.status = result.solved ? STATUS_SOLVED : STATUS_UNSOLVABLE;
+    }
+    result.complete = percent_complete();
+    result.guesses = guesses_;
+    result.memo_hits = memo_hits_;
+    result.memo_misses = memo_misses_;
+    result.probes = probes_;
+    result.components = components_;
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+
+    return result;
 }
 
 // Rule Debugger
@@ -112,301 +442,1482 @@ void solver::dump_rules()
         cout << endl;
     }
 
-    unsigned col_tally = 0;
-    cout << endl << "Cols:" << endl << endl;
-    for (unsigned i = 0; i < col_rules_.size(); i++)
+    unsigned col_tally = 0;
+    cout << endl << "Cols:" << endl << endl;
+    for (unsigned i = 0; i < col_rules_.size(); i++)
+    {
+        if ((i % 5) == 0)
+        {
+            cout << endl;
+        }
+        for (unsigned j = 0; j < col_rules_[i].size(); j++)
+        {
+            cout << " " << (int)(col_rules_[i][j].count);
+            col_tally += col_rules_[i][j].count;
+        }
+        cout << endl;
+    }
+
+    cout << "Total row/col sums: " << (int)row_tally << " " << (int)col_tally << endl;
+}
+
+bool solver::is_solved()
+{
+    for (size_t i = 0; i < board_.size(); i++)
+    {
+        uint32_t cell = board_[i];
+        if (cell & (cell - 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Are all cells in focus solved?
+bool solver::focus_solved()
+{
+    for (size_t i = 0; i < board_.size(); i++)
+    {
+        uint32_t value = board_[i];
+        if ((value & (value - 1)) && in_focus(i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Split unsolved cells in focus into groups that don't constrain each
+// other, and if there's more than one, put each in a focus of its own from
+// next_focus_ on (returns the number of groups)
+size_t solver::find_components()
+{
+    PROFILE_STAGE(profile_, STAGE_SPLIT);
+
+    // Unsolved cells are linked to the next along each row and column,
+    // unless every placement of the line's rule puts the same segments
+    // before the gap (as can happen once solved cells pin segments down)
+    size_t ncells = nrows_ * ncols_;
+    component_root_.resize(ncells);
+    for (size_t i = 0; i < ncells; i++)
+    {
+        component_root_[i] = i;
+    }
+    line_cuts_.resize(max(nrows_, ncols_));
+    for (size_t line = 0; line < nrows_ + ncols_; line++)
+    {
+        bool row = (line < nrows_);
+        size_t length = row ? ncols_ : nrows_;
+        uint32_t const *cells = row ? row_cells(line)
+                                    : col_cells(line - nrows_);
+
+        // Only a line with solved cells between unsolved ones can split
+        size_t runs = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            bool open = (cells[i] & (cells[i] - 1));
+            if (open && ((i == 0) || !(cells[i - 1] & (cells[i - 1] - 1))))
+            {
+                runs++;
+            }
+        }
+        uint8_t *cut = &line_cuts_[0];
+        if (runs > 1)
+        {
+            if (!line_.cuts(row ? row_rules_[line] : col_rules_[line - nrows_],
+                            cells, length, cut))
+            {
+                // Contradiction, left for search to find
+                return 1;
+            }
+        }
+
+        size_t prev = ncells;
+        for (size_t i = 0; i < length; i++)
+        {
+            size_t index = row ? line * ncols_ + i
+                               : i * ncols_ + line - nrows_;
+            if ((prev != ncells) && (runs > 1) && cut[i])
+            {
+                prev = ncells;
+            }
+            uint32_t value = board_[index];
+            if ((value & (value - 1)) && in_focus(index))
+            {
+                if (prev != ncells)
+                {
+                    size_t a = find_root(prev);
+                    size_t b = find_root(index);
+                    if (a != b)
+                    {
+                        component_root_[max(a, b)] = min(a, b);
+                    }
+                }
+                prev = index;
+            }
+        }
+    }
+
+    // Count groups (the root of each is its first cell)
+    size_t count = 0;
+    for (size_t i = 0; i < ncells; i++)
+    {
+        uint32_t value = board_[i];
+        if ((value & (value - 1)) && in_focus(i) && (find_root(i) == i))
+        {
+            count++;
+        }
+    }
+    if (count < 2)
+    {
+        return count;
+    }
+
+    // Number groups in order of their first cell, then label their cells
+    uint32_t outer = focus_;
+    for (size_t i = 0; i < ncells; i++)
+    {
+        uint32_t value = board_[i];
+        if ((value & (value - 1)) && (cell_focus_[i] == outer))
+        {
+            size_t root = find_root(i);
+            if (root == i)
+            {
+                cell_focus_[i] = next_focus_++;
+            }
+            else
+            {
+                cell_focus_[i] = cell_focus_[root];
+            }
+        }
+    }
+    return count;
+}
+
+// Root of a cell's group, halving paths on the way
+size_t solver::find_root(size_t index)
+{
+    while (component_root_[index] != index)
+    {
+        component_root_[index] = component_root_[component_root_[index]];
+        index = component_root_[index];
+    }
+    return index;
+}
+
+// Search each group found by find_components() (focus first onwards) on
+// its own, in turn or as parallel tasks, then put their lines back in the
+// current focus (false if any group has no solution)
+bool solver::solve_components(size_t first, size_t count)
+{
+    uint32_t outer = focus_;
+    bool solved;
+    if (counting())
+    {
+        solved = count_components(first, count);
+    }
+    else if (pool_ && pool_->has_idle())
+    {
+        solved = components_parallel(first, count);
+    }
+    else
+    {
+        solved = true;
+        for (size_t k = 0; (k < count) && solved; k++)
+        {
+            focus_ = first + k;
+            components_++;
+            solved = run();
+        }
+    }
+
+    focus_ = outer;
+    for (size_t i = 0; i < cell_focus_.size(); i++)
+    {
+        if (cell_focus_[i] >= first)
+        {
+            cell_focus_[i] = outer;
+        }
+    }
+    next_focus_ = first;
+    return solved;
+}
+
+// Count solutions of each group in turn, and combine them: counts
+// multiply, the first solution takes the first of every group, and the
+// second (if any) differs from it in the first group with two (true if
+// that's enough solutions)
+bool solver::count_components(size_t first, size_t count)
+{
+    size_t ncells = board_.size();
+
+    // Set aside solutions found before, with room for a group's second
+    size_t found = solutions_;
+    size_t base = count_stack_.size();
+    count_stack_.insert(count_stack_.end(), solution_cells_.begin(),
+                        solution_cells_.end());
+    count_stack_.resize(base + 3 * ncells);
+    size_t second = base + 2 * ncells;
+    size_t second_group = count;
+
+    size_t total = 1;
+    for (size_t k = 0; (k < count) && (total > 0); k++)
+    {
+        // Count this group's solutions, then back out
+        focus_ = first + k;
+        components_++;
+        solutions_ = 0;
+        guess_depth_++;
+        checkpoint_t mark = checkpoint();
+        run();
+        rollback(mark);
+        guess_depth_--;
+
+        // Combine counts, going no further than the limit
+        if ((solutions_ == 0) || (total >= solution_limit_ / solutions_))
+        {
+            total = (solutions_ == 0) ? 0 : solution_limit_;
+        }
+        else
+        {
+            total *= solutions_;
+        }
+
+        // Keep its first solution, and its second if it's the first to
+        // have one
+        for (size_t i = 0; (i < ncells) && (solutions_ > 0); i++)
+        {
+            if (cell_focus_[i] == focus_)
+            {
+                store_cell(i / ncols_, i % ncols_, solution_cells_[i]);
+            }
+        }
+        if ((solutions_ > 1) && (second_group == count))
+        {
+            second_group = k;
+            copy(solution_cells_.begin() + ncells, solution_cells_.end(),
+                 count_stack_.begin() + second);
+        }
+    }
+
+    // Back to solutions found before, plus the ones just put together
+    copy(count_stack_.begin() + base, count_stack_.begin() + second,
+         solution_cells_.begin());
+    solutions_ = found;
+    for (size_t n = 0; (n < total) && (n < 2) && (solutions_ < 2); n++)
+    {
+        uint32_t *cells = &solution_cells_[solutions_ * ncells];
+        copy(board_.begin(), board_.end(), cells);
+        for (size_t i = 0; (i < ncells) && (n == 1); i++)
+        {
+            if (cell_focus_[i] == first + second_group)
+            {
+                cells[i] = count_stack_[second + i];
+            }
+        }
+        solutions_++;
+    }
+    solutions_ = min(solution_limit_, found + total);
+    count_stack_.resize(base);
+    return (solutions_ >= solution_limit_);
+}
+
+// Search groups as parallel tasks, each on a copy of the board, and merge
+// the cells of each back in (false if any group has no solution, which
+// cancels the rest)
+bool solver::components_parallel(size_t first, size_t count)
+{
+    std::vector<solver *> branches(count, (solver *)NULL);
+    std::vector<char> found(count, false);
+    std::vector<cancel_token_t> tokens(count);
+    atomic<size_t> failed(1);
+    atomic<size_t> pending(count);
+
+    for (size_t k = 0; k < count; k++)
+    {
+        // Group is abandoned once any other group fails
+        tokens[k].best = &failed;
+        tokens[k].index = 1;
+        tokens[k].parent = cancel_;
+
+        pool_->submit([&, k]()
+        {
+            if (!tokens[k].cancelled())
+            {
+                solver *branch = new solver(*this);
+                branch->start_branch(&tokens[k]);
+                branch->focus_ = first + k;
+                found[k] = branch->run();
+                if (!found[k])
+                {
+                    failed = 0;
+                }
+                branches[k] = branch;
+            }
+            pending--;
+        });
+    }
+    pool_->wait_until([&]() { return pending == 0; });
+
+    // Take over each group's cells, then prune pattern lists to match
+    bool solved = (failed != 0) && !cancelled();
+    for (size_t k = 0; k < count; k++)
+    {
+        solver *branch = branches[k];
+        if (!branch)
+        {
+            solved = false;
+            continue;
+        }
+        if (solved && found[k])
+        {
+            merge_branch(*branch, first + k);
+        }
+        guesses_ += branch->guesses_;
+        memo_hits_ += branch->memo_hits_;
+        memo_misses_ += branch->memo_misses_;
+        probes_ += branch->probes_;
+        components_ += branch->components_ + 1;
+        PROFILE_COUNT(profile_.add(branch->profile_));
+        delete branch;
+    }
+    return solved && propagate();
+}
+
+// Re-evaluate dirty lines until none remain, or limit lines have been
+// evaluated (false on contradiction)
+bool solver::propagate(size_t limit)
+{
+    PROFILE_STAGE(profile_, STAGE_APPLY);
+    for (size_t done = 0; (dirty_count_ > 0) && (done < limit); done++)
+    {
+        size_t line = next_dirty_line();
+
+        bool consistent;
+        if (line < nrows_)
+        {
+            consistent = apply_row_patterns(line);
+        }
+        else
+        {
+            consistent = apply_col_patterns(line - nrows_);
+        }
+
+        if (!consistent || cancelled())
+        {
+            return false;
+        }
+        if (((++stop_checks_ % stop_check_interval) == 0) && check_limits())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Try each color of each unsolved cell with bounded propagation, dropping
+// colors that lead to contradictions and fixing cells that come out the
+// same under every color left, until nothing changes (false on
+// contradiction)
+bool solver::probe()
+{
+    PROFILE_STAGE(profile_, STAGE_PROBE);
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() +
+        chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<double>(probe_seconds_));
+    size_t ncells = nrows_ * ncols_;
+    probe_seen_.resize(ncells, 0);
+    probe_union_.resize(ncells);
+    probe_count_.resize(ncells);
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 0; i < ncells; i++)
+        {
+            uint32_t value = board_[i];
+            if (((value & (value - 1)) == 0) || !in_focus(i))
+            {
+                continue;
+            }
+            if (cancelled() || (chrono::steady_clock::now() > deadline))
+            {
+                return true;
+            }
+
+            // Colors of this cell that survive, and how many
+            uint32_t kept = 0;
+            size_t nkept = 0;
+            size_t first = probe_serial_;
+            probe_cells_.clear();
+
+            guess_depth_++;
+            checkpoint_t mark = checkpoint();
+            uint32_t colors = value;
+            while (colors)
+            {
+                uint32_t bit = colors & (~colors + 1);
+                colors &= ~bit;
+
+                // Propagation cut short still leaves only consequences of
+                // the color, so it's safe to go by
+                probes_++;
+                set_cell(i / ncols_, i % ncols_, bit);
+                if (propagate(probe_line_limit * (nrows_ + ncols_)))
+                {
+                    kept |= bit;
+                    nkept++;
+                    note_probe(mark, first);
+                }
+                else if (cancelled())
+                {
+                    rollback(mark);
+                    guess_depth_--;
+                    return true;
+                }
+                rollback(mark);
+            }
+            guess_depth_--;
+
+            // No color works?
+            if (nkept == 0)
+            {
+                return false;
+            }
+
+            // Keep what held under every color left (including the colors
+            // of the cell itself)
+            for (size_t k = 0; k < probe_cells_.size(); k++)
+            {
+                size_t j = probe_cells_[k];
+                if (probe_count_[j] == nkept)
+                {
+                    set_cell(j / ncols_, j % ncols_,
+                             board_[j] & probe_union_[j]);
+                }
+            }
+            set_cell(i / ncols_, i % ncols_, value & kept);
+            if (dirty_count_ > 0)
+            {
+                changed = true;
+                if (!propagate())
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Add cells changed by one probe (since mark) to the union of colors seen
+// under each color probed (since serial first)
+void solver::note_probe(checkpoint_t const &mark, size_t first)
+{
+    size_t serial = ++probe_serial_;
+    for (size_t k = mark.cells; k < cell_trail_.size(); k++)
+    {
+        size_t j = cell_trail_[k].index;
+        if (probe_seen_[j] == serial)
+        {
+            continue;
+        }
+        if (probe_seen_[j] <= first)
+        {
+            // First seen while probing this cell
+            probe_union_[j] = 0;
+            probe_count_[j] = 0;
+            probe_cells_.push_back(j);
+        }
+        probe_seen_[j] = serial;
+        probe_union_[j] |= board_[j];
+        probe_count_[j]++;
+    }
+}
+
+// Queue a row for re-evaluation
+void solver::mark_row_dirty(size_t r)
+{
+    mark_line_dirty(r);
+}
+
+// Queue a column for re-evaluation
+void solver::mark_col_dirty(size_t c)
+{
+    mark_line_dirty(nrows_ + c);
+}
+
+// Queue a line (row, or column offset by nrows_) for re-evaluation
+void solver::mark_line_dirty(size_t line)
+{
+    if (!line_queued_[line])
+    {
+        line_queued_[line] = true;
+        size_t tail = dirty_head_ + dirty_count_;
+        if (tail >= dirty_lines_.size())
+        {
+            tail -= dirty_lines_.size();
+        }
+        dirty_lines_[tail] = line;
+        dirty_count_++;
+    }
+}
+
+// Take next line off the queue
+size_t solver::next_dirty_line()
+{
+    size_t line = dirty_lines_[dirty_head_];
+    line_queued_[line] = false;
+    if (++dirty_head_ == dirty_lines_.size())
+    {
+        dirty_head_ = 0;
+    }
+    dirty_count_--;
+    return line;
+}
+
+// Fix a cell to a narrower set of colors, and queue crossing lines
+void solver::set_cell(size_t r, size_t c, uint32_t value)
+{
+    if (cell(r, c) == value)
+    {
+        return;
+    }
+
+    store_cell(r, c, value);
+    mark_row_dirty(r);
+    mark_col_dirty(c);
+}
+
+// Update a cell, keeping solved count and undo trail current
+void solver::store_cell(size_t r, size_t c, uint32_t value)
+{
+    uint32_t &cell = board_[r * ncols_ + c];
+
+    // Remember old value if we may need to back out
+    if (guess_depth_ > 0)
+    {
+        trail_entry_t undo = { r * ncols_ + c, cell };
+        cell_trail_.push_back(undo);
+    }
+
+    // Newly solved (power of 2)?
+    if ((value & (value - 1)) == 0 && (cell & (cell - 1)) != 0)
+    {
+        solved_cells_++;
+    }
+    cell = value;
+    board_t_[c * nrows_ + r] = value;
+}
+
+// Save state for a later rollback
+solver::checkpoint_t solver::checkpoint() const
+{
+    checkpoint_t mark = { cell_trail_.size(), pattern_trail_.size(),
+                          solved_cells_, split_solved_ };
+    return mark;
+}
+
+// Undo all changes made since checkpoint
+void solver::rollback(checkpoint_t const &mark)
+{
+    // Restore cells, newest first
+    while (cell_trail_.size() > mark.cells)
+    {
+        trail_entry_t &undo = cell_trail_.back();
+        board_[undo.index] = undo.value;
+        board_t_[(undo.index % ncols_) * nrows_ + undo.index / ncols_] = undo.value;
+        cell_trail_.pop_back();
+    }
+
+    // Pruning only reorders ids within the live range, so growing the
+    // range back restores the discarded patterns
+    while (pattern_trail_.size() > mark.patterns)
+    {
+        trail_entry_t &undo = pattern_trail_.back();
+        if (undo.index < nrows_)
+        {
+            row_live_[undo.index] = undo.value;
+        }
+        else
+        {
+            col_live_[undo.index - nrows_] = undo.value;
+        }
+        pattern_trail_.pop_back();
+    }
+
+    solved_cells_ = mark.solved;
+    split_solved_ = mark.split;
+
+    // Drop any half finished propagation
+    while (dirty_count_ > 0)
+    {
+        next_dirty_line();
+    }
+}
+
+// Filter board by row possibilities (false on contradiction)
+bool solver::apply_row_patterns(size_t r)
+{
+    PROFILE_COUNT(profile_.count_line());
+    pattern_t &rem = rem_;
+    rem.resize(ncols_);
+
+    // Seen this row in the same state before?
+    bool consistent;
+    uint32_t rule = line_rules_[r];
+    if (memo_.find(rule, row_cells(r), ncols_, consistent, &rem[0]))
+    {
+        memo_hits_++;
+    }
+    else
+    {
+        memo_misses_++;
+        consistent = reduce_row(r, &rem[0]);
+        memo_.store(rule, row_cells(r), ncols_, consistent, &rem[0]);
+    }
+    if (!consistent)
+    {
+        return false;
+    }
+
+    // Use combined possibilities to filter possibilities on board
+    size_t old_count = solved_cells_;
+    for (size_t c = 0; c < ncols_; c++)
+    {
+        uint32_t cell = row_cells(r)[c];
+        if ((cell & rem[c]) != cell)
+        {
+            // Filter, and only the crossing column needs another look
+            uint32_t value = cell & rem[c];
+            if (value == 0)
+            {
+                return false;
+            }
+            store_cell(r, c, value);
+            mark_col_dirty(c);
+        }
+    }
+
+    // progress?
+    if (solved_cells_ != old_count)
+    {
+        pause();
+    }
+    return true;
+}
+
+// Filter board by column possibilities (false on contradiction)
+bool solver::apply_col_patterns(size_t c)
+{
+    PROFILE_COUNT(profile_.count_line());
+    pattern_t &rem = rem_;
+    rem.resize(nrows_);
+
+    // Seen this column in the same state before?
+    bool consistent;
+    uint32_t rule = line_rules_[nrows_ + c];
+    if (memo_.find(rule, col_cells(c), nrows_, consistent, &rem[0]))
+    {
+        memo_hits_++;
+    }
+    else
+    {
+        memo_misses_++;
+        consistent = reduce_col(c, &rem[0]);
+        memo_.store(rule, col_cells(c), nrows_, consistent, &rem[0]);
+    }
+    if (!consistent)
+    {
+        return false;
+    }
+
+    // Use combined possibilities to filter possibilities on board
+    size_t old_count = solved_cells_;
+    for (size_t r = 0; r < nrows_; r++)
+    {
+        uint32_t cell = col_cells(c)[r];
+        if ((cell & rem[r]) != cell)
+        {
+            // Filter, and only the crossing row needs another look
+            uint32_t value = cell & rem[r];
+            if (value == 0)
+            {
+                return false;
+            }
+            store_cell(r, c, value);
+            mark_row_dirty(r);
+        }
+    }
+
+    // progress?
+    if (solved_cells_ != old_count)
+    {
+        pause();
+    }
+    return true;
+}
+
+// Union of placements still possible for a row (false on contradiction)
+bool solver::reduce_row(size_t r, uint32_t *rem)
+{
+    if (engine_ == ENGINE_DP)
+    {
+        // Solve for union of placements directly against board
+        return line_.solve(row_rules_[r], row_cells(r), ncols_, rem);
+    }
+
+    // Discard patterns invalidated since last visit
+    if (!prune_row_patterns(r))
+    {
+        return false;
+    }
+
+    // Collect OR bitmask of all remaining patterns
+    if (engine_ == ENGINE_BITS)
+    {
+        row_packed_[r]->reduce(row_ids(r), row_live_[r], rem,
+                               packed_scratch_);
+    }
+    else
+    {
+        row_patterns_[r]->reduce(row_ids(r), row_live_[r], rem,
+                                 set_scratch_);
+    }
+    return true;
+}
+
+// Discard row patterns that no longer match (false if none left)
+bool solver::prune_row_patterns(size_t r)
+{
+    PROFILE_STAGE(profile_, STAGE_PRUNE);
+    size_t &live = row_live_[r];
+    size_t old_live = live;
+    uint32_t const *cells = row_cells(r);
+
+    // Culled ids collect past the end of the live range, so they can be
+    // restored on rollback
+    if (engine_ == ENGINE_BITS)
+    {
+        live = row_packed_[r]->prune(row_ids(r), live, cells, packed_scratch_);
+    }
+    else
+    {
+        live = row_patterns_[r]->prune(row_ids(r), live, cells, set_scratch_);
+    }
+
+    // Remember old count if we may need to back out
+    if (guess_depth_ > 0 && live != old_live)
+    {
+        trail_entry_t undo = { r, (uint32_t)old_live };
+        pattern_trail_.push_back(undo);
+    }
+    PROFILE_COUNT(profile_.count_pruned(r, old_live - live));
+
+    // Anything left?
+    return (live > 0);
+}
+
+// Union of placements still possible for a column (false on contradiction)
+bool solver::reduce_col(size_t c, uint32_t *rem)
+{
+    if (engine_ == ENGINE_DP)
+    {
+        // Solve for union of placements directly against board
+        return line_.solve(col_rules_[c], col_cells(c), nrows_, rem);
+    }
+
+    // Discard patterns invalidated since last visit
+    if (!prune_col_patterns(c))
+    {
+        return false;
+    }
+
+    // Collect OR bitmask of all remaining patterns
+    if (engine_ == ENGINE_BITS)
+    {
+        col_packed_[c]->reduce(col_ids(c), col_live_[c], rem,
+                               packed_scratch_);
+    }
+    else
+    {
+        col_patterns_[c]->reduce(col_ids(c), col_live_[c], rem,
+                                 set_scratch_);
+    }
+    return true;
+}
+
+// Discard column patterns that no longer match (false if none left)
+bool solver::prune_col_patterns(size_t c)
+{
+    PROFILE_STAGE(profile_, STAGE_PRUNE);
+    size_t &live = col_live_[c];
+    size_t old_live = live;
+    uint32_t const *cells = col_cells(c);
+
+    // Culled ids collect past the end of the live range, so they can be
+    // restored on rollback
+    if (engine_ == ENGINE_BITS)
+    {
+        live = col_packed_[c]->prune(col_ids(c), live, cells, packed_scratch_);
+    }
+    else
+    {
+        live = col_patterns_[c]->prune(col_ids(c), live, cells, set_scratch_);
+    }
+
+    // Remember old count if we may need to back out
+    if (guess_depth_ > 0 && live != old_live)
+    {
+        trail_entry_t undo = { nrows_ + c, (uint32_t)old_live };
+        pattern_trail_.push_back(undo);
+    }
+    PROFILE_COUNT(profile_.count_pruned(nrows_ + c, old_live - live));
+
+    // Anything left?
+    return (live > 0);
+}
+
+void solver::make_a_guess()
+{
+    PROFILE_STAGE(profile_, STAGE_GUESS);
+
+    // If we're here, the puzzle can't be solved by straight row/column
+    // elimination, so we'll pick an arbitrary pattern and see if it works out
+    //
+    // Options stack up above those of the guesses already in progress, and
+    // come off again when done, so their storage gets reused
+    size_t line;
+    size_t first = guess_order_.size();
+    size_t base = guess_cells_.size();
+    if ((engine_ == ENGINE_DP) || (branching_ == BRANCH_CELLS))
+    {
+        if (!pick_cell_guess(line))
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (!pick_pattern_guess(line))
+        {
+            return;
+        }
+    }
+    size_t last = guess_order_.size();
+
+    // Hand sibling guesses to idle workers, if any (unless counting, which
+    // takes every guess in order)
+    if (pool_ && !counting() && (last - first > 1) && pool_->has_idle())
+    {
+        guess_parallel(line, first, last);
+    }
+    else
+    {
+        guess_serial(line, first, last);
+    }
+
+    guess_order_.resize(first);
+    guess_cells_.resize(base);
+}
+
+// Guess by stamping each remaining pattern of a line
+bool solver::pick_pattern_guess(size_t &line)
+{
+    // Find the first row that isn't solved, or the row or column with the
+    // fewest patterns left (memo hits skip pruning, so bring each line's
+    // patterns up to date on the way)
+    size_t nlines = (branching_ == BRANCH_FEWEST) ? nrows_ + ncols_ : nrows_;
+    size_t live = 0;
+    line = nlines;
+    for (size_t i = 0; i < nlines; i++)
+    {
+        size_t count;
+        if (!line_in_focus(i))
+        {
+            continue;
+        }
+        if (i < nrows_)
+        {
+            prune_row_patterns(i);
+            count = row_live_[i];
+        }
+        else
+        {
+            prune_col_patterns(i - nrows_);
+            count = col_live_[i - nrows_];
+        }
+        if ((count != 1) && ((line == nlines) || (count < live)))
+        {
+            line = i;
+            live = count;
+            if ((branching_ == BRANCH_FIRST) || (live <= 2))
+            {
+                break;
+            }
+        }
+    }
+    if (line == nlines)
+    {
+        // All solved?
+        return false;
+    }
+
+    // Branches reorder the live ids, so keep our own list of options,
+    // back in generated order (left-most placements first) so it doesn't
+    // depend on which branches were tried before
+    bool row = (line < nrows_);
+    size_t length = row ? ncols_ : nrows_;
+    uint32_t const *ids = row ? row_ids(line) : col_ids(line - nrows_);
+    size_t first = guess_order_.size();
+    size_t base = guess_cells_.size();
+    guess_order_.insert(guess_order_.end(), ids, ids + live);
+    sort(guess_order_.begin() + first, guess_order_.end());
+    guess_cells_.resize(base + live * length);
+    for (size_t k = 0; k < live; k++)
+    {
+        size_t id = guess_order_[first + k];
+        size_t option = base + k * length;
+        if (engine_ == ENGINE_BITS)
+        {
+            (row ? row_packed_[line] : col_packed_[line - nrows_])
+                ->unpack(id, &guess_cells_[option]);
+        }
+        else
+        {
+            (row ? row_patterns_[line] : col_patterns_[line - nrows_])
+                ->unpack(id, &guess_cells_[option]);
+        }
+        guess_order_[first + k] = option;
+    }
+
+    // Leave cells outside the focus alone, which can leave options that
+    // are the same, so keep only the first of each
+    bool masked = false;
+    for (size_t i = 0; i < length; i++)
+    {
+        size_t index = row ? line * ncols_ + i
+                           : i * ncols_ + line - nrows_;
+        uint32_t value = board_[index];
+        if ((value & (value - 1)) && !in_focus(index))
+        {
+            masked = true;
+            for (size_t k = 0; k < live; k++)
+            {
+                guess_cells_[base + k * length + i] = (uint32_t)-1;
+            }
+        }
+    }
+    if (masked)
+    {
+        unique_options(first, length);
+    }
+    return true;
+}
+
+// Drop options from first on that repeat an earlier one, keeping order
+void solver::unique_options(size_t first, size_t length)
+{
+    // Sort by cells, then by order, so the first of each run is the one
+    // to keep
+    uint32_t const *cells = guess_cells_.data();
+    size_t const *order = guess_order_.data();
+    size_t count = guess_order_.size() - first;
+    option_sort_.resize(count);
+    for (size_t k = 0; k < count; k++)
     {
-        if ((i % 5) == 0)
-        {
-            cout << endl;
-        }
-        for (unsigned j = 0; j < col_rules_[i].size(); j++)
+        option_sort_[k] = k;
+    }
+    sort(option_sort_.begin(), option_sort_.end(), [&](size_t a, size_t b)
+    {
+        int diff = memcmp(cells + order[first + a], cells + order[first + b],
+                          length * sizeof(uint32_t));
+        return (diff != 0) ? (diff < 0) : (a < b);
+    });
+
+    // Blank out repeats, then close up the gaps
+    for (size_t k = count; k-- > 1; )
+    {
+        size_t a = option_sort_[k - 1];
+        size_t b = option_sort_[k];
+        if (memcmp(cells + order[first + a], cells + order[first + b],
+                   length * sizeof(uint32_t)) == 0)
         {
-            cout << " " << (int)(col_rules_[i][j].count);
-            col_tally += col_rules_[i][j].count;
+            guess_order_[first + b] = (size_t)-1;
         }
-        cout << endl;
     }
-
-    cout << "Total row/col sums: " << (int)row_tally << " " << (int)col_tally << endl;
+    guess_order_.erase(remove(guess_order_.begin() + first,
+                              guess_order_.end(), (size_t)-1),
+                       guess_order_.end());
 }
 
-bool solver::is_solved()
+// Does a line (rows, then columns offset by nrows_) hold an unsolved cell
+// in focus?
+bool solver::line_in_focus(size_t line)
 {
-    for (size_t r = 0; r < nrows_; r++)
+    bool row = (line < nrows_);
+    size_t length = row ? ncols_ : nrows_;
+    for (size_t i = 0; i < length; i++)
     {
-        for (size_t c = 0; c < ncols_; c++)
+        size_t index = row ? line * ncols_ + i
+                           : i * ncols_ + line - nrows_;
+        uint32_t value = board_[index];
+        if ((value & (value - 1)) && in_focus(index))
         {
-            uint32_t cell = board_[r][c];
-            if (cell & (cell - 1))
-            {
-                return false;
-            }
+            return true;
         }
     }
-    return true;
+    return false;
 }
 
-void solver::apply_row_patterns()
+// Guess by trying each remaining color of an unsolved cell
+bool solver::pick_cell_guess(size_t &line)
 {
-    for (size_t r = 0; r < nrows_; r++)
+    // Weight of each color of the cell picked (by color index), if any
+    double weights[32];
+    size_t ncells = nrows_ * ncols_;
+    size_t index = ncells;
+    if ((branching_ == BRANCH_CELLS) && (engine_ != ENGINE_DP))
+    {
+        index = pick_likely_cell(weights);
+    }
+    else
     {
-        // Collect OR bitmask of all remaining patterns
-        pattern_t rem = row_patterns_[r][0];
-        for (size_t id = 1; id < row_patterns_[r].size(); id++)
+        // Find the first cell that isn't solved, or the one with the fewest
+        // colors left (DP keeps no patterns to count, so that's the best
+        // it can do for BRANCH_CELLS too)
+        size_t fewest = 0;
+        for (size_t i = 0; i < ncells; i++)
         {
-            pattern_t &cur = row_patterns_[r][id];
-            for (size_t c = 0; c < ncols_; c++)
+            uint32_t value = board_[i];
+            if ((value & (value - 1)) && in_focus(i))
             {
-                rem[c] |= cur[c];
+                size_t count = __builtin_popcount(value);
+                if ((index == ncells) || (count < fewest))
+                {
+                    index = i;
+                    fewest = count;
+                    if ((branching_ == BRANCH_FIRST) || (fewest == 2))
+                    {
+                        break;
+                    }
+                }
             }
         }
+    }
+    if (index == ncells)
+    {
+        // All solved?
+        return false;
+    }
+    line = index / ncols_;
+    size_t c = index % ncols_;
 
-        // Use combined possibilities to filter possibilities on board
-        size_t old_count = solved_cells_;
-        for (size_t c = 0; c < ncols_; c++)
+    // Colors to try, in table order, or likeliest first when weighed
+    size_t order[32];
+    size_t ncolors = 0;
+    for (size_t k = 0; k < color_table_size; k++)
+    {
+        if (board_[index] & color_table[k].bitmask)
         {
-            uint32_t &cell = board_[r][c];
-            if (cell != rem[c])
+            size_t at = ncolors++;
+            if ((branching_ == BRANCH_CELLS) && (engine_ != ENGINE_DP))
             {
-                // Filter
-                cell &= rem[c];
-
-                // Check if solved (power of 2)
-                if ((cell & (cell - 1)) == 0)
+                for (; (at > 0) && (weights[order[at - 1]] < weights[k]); at--)
                 {
-                    solved_cells_++;
-                }
-
-                // Sanity check
-                if (cell == 0)
-                {
-                    bail("Puzzle not solvable");
+                    order[at] = order[at - 1];
                 }
             }
+            order[at] = k;
         }
+    }
 
-        // progress?
-        if (solved_cells_ != old_count)
-        {
-            prune_col_patterns();
-            pause();
-        }
+    // One option per remaining color, leaving rest of row alone
+    for (size_t k = 0; k < ncolors; k++)
+    {
+        size_t option = guess_cells_.size();
+        guess_cells_.resize(option + ncols_, (uint32_t)-1);
+        guess_cells_[option + c] = color_table[order[k]].bitmask;
+        guess_order_.push_back(option);
     }
+    return true;
 }
 
-void solver::apply_col_patterns()
+// Unsolved cell whose likeliest color is most certain, going by the live
+// patterns of its row and column, with weights of its colors (by color
+// index) filled in (nrows_ * ncols_ if all solved)
+size_t solver::pick_likely_cell(double *weights)
 {
+    size_t ncolors = color_table_size;
+    size_t ncells = nrows_ * ncols_;
+    size_t index = ncells;
+    double certainty = 0;
+
+    // Count colors over each row's live patterns (memo hits skip pruning,
+    // so bring them up to date first)
+    row_counts_.resize(ncells * ncolors);
+    for (size_t r = 0; r < nrows_; r++)
+    {
+        prune_row_patterns(r);
+        uint32_t *counts = &row_counts_[r * ncols_ * ncolors];
+        if (engine_ == ENGINE_BITS)
+        {
+            row_packed_[r]->count(row_ids(r), row_live_[r], counts);
+        }
+        else
+        {
+            row_patterns_[r]->count(row_ids(r), row_live_[r], counts);
+        }
+    }
+
+    // Then a column at a time, weigh each color of each unsolved cell by
+    // the chance of row and column both picking it, were they independent
+    // (dividing by live counts cancels out once normalized, so is skipped)
+    col_counts_.resize(nrows_ * ncolors);
     for (size_t c = 0; c < ncols_; c++)
     {
-        // Collect OR bitmask of all remaining patterns
-        pattern_t rem = col_patterns_[c][0];
-        for (size_t id = 1; id < col_patterns_[c].size(); id++)
+        prune_col_patterns(c);
+        uint32_t *counts = &col_counts_[0];
+        if (engine_ == ENGINE_BITS)
         {
-            pattern_t &cur = col_patterns_[c][id];
-            for (size_t r = 0; r < nrows_; r++)
-            {
-                rem[r] |= cur[r];
-            }
+            col_packed_[c]->count(col_ids(c), col_live_[c], counts);
+        }
+        else
+        {
+            col_patterns_[c]->count(col_ids(c), col_live_[c], counts);
         }
 
-        // Use combined possibilities to filter possibilities on board
-        size_t old_count = solved_cells_;
         for (size_t r = 0; r < nrows_; r++)
         {
-            uint32_t &cell = board_[r][c];
-            if (cell != rem[r])
+            uint32_t value = cell(r, c);
+            if (((value & (value - 1)) == 0) || !in_focus(r * ncols_ + c))
             {
-                // Filter
-                board_[r][c] &= rem[r];
-
-                // Check if solved (power of 2)
-                if ((cell & (cell - 1)) == 0)
-                {
-                    solved_cells_++;
-                }
+                continue;
+            }
 
-                // Sanity check
-                if (cell == 0)
+            double cell_weights[32];
+            double total = 0;
+            double likeliest = 0;
+            uint32_t const *row = &row_counts_[(r * ncols_ + c) * ncolors];
+            uint32_t const *col = &counts[r * ncolors];
+            for (size_t k = 0; k < ncolors; k++)
+            {
+                cell_weights[k] = 0;
+                if (value & color_table[k].bitmask)
                 {
-                    bail("Puzzle not solvable");
+                    cell_weights[k] = (double)row[k] * col[k];
+                    total += cell_weights[k];
+                    likeliest = max(likeliest, cell_weights[k]);
                 }
             }
+            if ((total > 0) && (likeliest / total > certainty))
+            {
+                index = r * ncols_ + c;
+                certainty = likeliest / total;
+                copy(cell_weights, cell_weights + ncolors, weights);
+            }
         }
+    }
+    return index;
+}
 
-        // progress?
-        if (solved_cells_ != old_count)
+// Stamp a guess (offset of option in guess_cells_) on a row or column
+void solver::apply_guess(size_t line, size_t option)
+{
+    guesses_++;
+    stop_->guesses++;
+    PROFILE_COUNT(profile_.count_guess(guess_depth_));
+    if (line < nrows_)
+    {
+        for (size_t c = 0; c < ncols_; c++)
+        {
+            set_cell(line, c, cell(line, c) & guess_cells_[option + c]);
+        }
+    }
+    else
+    {
+        size_t c = line - nrows_;
+        for (size_t r = 0; r < nrows_; r++)
         {
-            prune_row_patterns();
-            pause();
+            set_cell(r, c, cell(r, c) & guess_cells_[option + r]);
         }
     }
 }
 
-// Discard row patterns that no longer match
-void solver::prune_row_patterns()
+// Try each guess in turn, and keep the first which produces a valid result
+void solver::guess_serial(size_t line, size_t first, size_t last)
 {
-    for (size_t r = 0; r < nrows_; r++)
+    guess_depth_++;
+    checkpoint_t mark = checkpoint();
+    for (size_t id = first; (id < last) && !cancelled(); id++)
     {
-        std::vector<pattern_t> &pats = row_patterns_[r];
+        apply_guess(line, guess_order_[id]);
 
-        for (size_t id = 0; id < pats.size(); id++)
+        // See if that worked ...
+        if (run())
         {
-            // Does this pattern still match the board?
-            pattern_t &cur = pats[id];
-            bool consistent = true;
-            for (size_t c = 0; c < ncols_; c++)
-            {
-                if ((cur[c] & board_[r][c]) == 0)
-                {
-                    consistent = false;
-                }
-            }
-
-            // If not, cull this pattern and continue
-            if (!consistent)
-            {
-                // Move last element to current spot in vector to
-                // avoid a large block copy
-                if (id < (pats.size() - 1))
-                {
-                    pats[id] = pats[pats.size() - 1];
-                }
-                
-                // Erase last element of vector
-                pats.erase(pats.begin() + pats.size() - 1);
-                id--;
-                continue;
-            }
+            // Guess it did ...
+            break;
         }
+
+        // That didn't work, back out everything this guess touched
+        rollback(mark);
     }
+    guess_depth_--;
 }
 
-// Discard column patterns that no longer match
-void solver::prune_col_patterns()
+// Try guesses as parallel tasks, keeping the first (in guess order) which
+// produces a valid result, so the answer matches guess_serial()
+void solver::guess_parallel(size_t line, size_t first, size_t last)
 {
-    for (size_t c = 0; c < ncols_; c++)
+    size_t count = last - first;
+    std::vector<solver *> branches(count, (solver *)NULL);
+    std::vector<cancel_token_t> tokens(count);
+    atomic<size_t> best(count);
+    atomic<size_t> pending(count);
+    atomic<unsigned long> guesses(0);
+    atomic<unsigned long> memo_hits(0);
+    atomic<unsigned long> memo_misses(0);
+    atomic<unsigned long> probes(0);
+#ifdef NONOGRAM_PROFILE
+    profile profiles;
+    mutex profiles_lock;
+#endif
+
+    for (size_t i = 0; i < count; i++)
     {
-        std::vector<pattern_t> &pats = col_patterns_[c];
+        // Branch is abandoned once an earlier sibling succeeds
+        tokens[i].best = &best;
+        tokens[i].index = i;
+        tokens[i].parent = cancel_;
 
-        for (size_t id = 0; id < pats.size(); id++)
+        pool_->submit([&, i]()
         {
-            // Does this pattern still match the board?
-            pattern_t &cur = pats[id];
-            bool consistent = true;
-            for (size_t r = 0; r < nrows_; r++)
+            if (!tokens[i].cancelled())
             {
-                if ((cur[r] & board_[r][c]) == 0)
+                // Scratch copy of the board as it stands before guessing
+                solver *branch = new solver(*this);
+                branch->start_branch(&tokens[i]);
+                branch->apply_guess(line, branch->guess_order_[first + i]);
+
+                bool solved = branch->run();
+                guesses += branch->guesses_;
+                memo_hits += branch->memo_hits_;
+                memo_misses += branch->memo_misses_;
+                probes += branch->probes_;
+#ifdef NONOGRAM_PROFILE
                 {
-                    consistent = false;
+                    lock_guard<mutex> lock(profiles_lock);
+                    profiles.add(branch->profile_);
                 }
-            }
+#endif
+                if (solved)
+                {
+                    branches[i] = branch;
 
-            // If not, cull this pattern and continue
-            if (!consistent)
-            {
-                // Move last element to current spot in vector to
-                // avoid a large block copy
-                if (id < (pats.size() - 1))
+                    // Lower best index, cancelling every later sibling
+                    size_t cur = best;
+                    while ((i < cur) && !best.compare_exchange_weak(cur, i))
+                    {
+                    }
+                }
+                else
                 {
-                    pats[id] = pats[pats.size() - 1];
+                    delete branch;
                 }
-                
-                // Erase last element of vector
-                pats.erase(pats.begin() + pats.size() - 1);
-                id--;
-                continue;
             }
-        }
+            pending--;
+        });
+    }
+
+    // Help out until every branch finishes or gives up
+    pool_->wait_until([&]() { return pending == 0; });
+
+    // Take over winning board, as if its guess had been made here
+    guesses_ += guesses;
+    memo_hits_ += memo_hits;
+    memo_misses_ += memo_misses;
+    probes_ += probes;
+    PROFILE_COUNT(profile_.add(profiles));
+    if (best < count)
+    {
+        merge_branch(*branches[best], any_focus);
+        propagate();
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        delete branches[i];
     }
 }
 
-void solver::make_a_guess()
+// Turn a copy of a solver into an independent search branch
+void solver::start_branch(cancel_token_t const *token)
 {
-    // If we're here, the puzzle can't be solved by straight row/column
-    // elimination, so we'll pick an arbitrary pattern and see if it works out
+    observer_ = NULL;
+    cancel_ = token;
+    guess_depth_ = 0;
+    guesses_ = 0;
+    memo_hits_ = 0;
+    memo_misses_ = 0;
+    probes_ = 0;
+    components_ = 0;
+    cell_trail_.clear();
+    pattern_trail_.clear();
+    PROFILE_COUNT(profile_.clear());
+}
 
-    // Find the first row that isn't solved
-    size_t r;
-    for (r = 0; r < nrows_; r++)
+// Take over the cells a search branch solved in a focus (or in any, for
+// any_focus), through the undo trail if guessing, and queue their lines so
+// pattern lists catch up when next propagated
+void solver::merge_branch(solver const &branch, uint32_t focus)
+{
+    for (size_t i = 0; i < board_.size(); i++)
     {
-        if (row_patterns_[r].size() != 1)
+        if (((focus == any_focus) || (cell_focus_[i] == focus)) &&
+            (board_[i] != branch.board_[i]))
         {
-            break;
+            set_cell(i / ncols_, i % ncols_, branch.board_[i]);
         }
     }
-    if (r == nrows_)
-    {
-        // All solved?
-        return;
-    }
+}
 
-    // Now we're going to try each possible remaining pattern, and find the
-    // first which produces a valid result
-    for (size_t id = 0; id < row_patterns_[r].size(); id++)
+// Has an earlier sibling of this branch (or of a parent) succeeded?
+bool solver::cancel_token_t::cancelled() const
+{
+    for (cancel_token_t const *token = this; token; token = token->parent)
     {
-        try
+        if (*token->best < token->index)
         {
-            // Make a clone for scratch space
-            solver clone(*this);
+            return true;
+        }
+    }
+    return false;
+}
 
-            // Stamp current pattern on chosen row in clone
-            pattern_t &cur = row_patterns_[r][id];
-            for (size_t c = 0; c < cur.size(); c++)
-            {
-                clone.board_[r][c] = cur[c];
-            }
+// Has this search branch been abandoned, or the solve stopped?
+bool solver::cancelled() const
+{
+    return stop_->stopped.load(memory_order_relaxed) ||
+           (limits_.cancel && limits_.cancel->load(memory_order_relaxed)) ||
+           (cancel_ && cancel_->cancelled());
+}
 
-            // See if that worked ...
-            if (clone.run())
-            {
-                // Guess it did ...
-                *this = clone;
-                return;
-            }
-        }
-        catch (exception &e)
-        {
-            // That didn't work
-        }
+// Stop the solve once past its deadline or guess budget (true if stopped)
+bool solver::check_limits()
+{
+    if ((limits_.guesses > 0) && (stop_->guesses >= limits_.guesses))
+    {
+        stop_->stopped = true;
     }
+    if ((limits_.seconds > 0) && (chrono::steady_clock::now() > deadline_))
+    {
+        stop_->stopped = true;
+    }
+    return cancelled();
+}
+
+// Set the deadline, counting from when loading started, and clear any
+// earlier stop
+void solver::start_limits()
+{
+    deadline_ = load_start_ +
+        chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<double>(limits_.seconds));
+    stop_->stopped = false;
+    stop_->guesses = 0;
+    stop_checks_ = 0;
 }
 
-// Run one pass of solver
+// Report progress to observer, if any
 void solver::pause()
 {
-    // Visualize board
-    show_board();
+    if (observer_)
+    {
+        observer_->progress(*this);
+    }
+}
 
-    // Track number of patterns in memory
+// Number of patterns still tracked
+unsigned long solver::pattern_count() const
+{
     unsigned long pcount = 0;
-    for (size_t r = 0; r < nrows_; r++)
+    for (size_t r = 0; r < row_live_.size(); r++)
     {
-        pcount += row_patterns_[r].size();
+        pcount += row_live_[r];
     }
-    for (size_t c = 0; c < ncols_; c++)
+    for (size_t c = 0; c < col_live_.size(); c++)
     {
-        pcount += col_patterns_[c].size();
+        pcount += col_live_[c];
     }
-    printf("Tracking %lu row/col patterns\n", pcount);
-
-    // Show progress
-    double pct = (100. * solved_cells_) / (nrows_ * ncols_);
-    printf("%.2f%% complete\n", pct);
+    return pcount;
+}
 
-    // Wait for user to hit enter
-    string foo;
-    getline(cin, foo);
+// Percentage of cells solved
+double solver::percent_complete() const
+{
+    return (100. * solved_cells_) / (nrows_ * ncols_);
 }
 
 // Show current state of puzzle
 void solver::show_board()
 {
-    for (size_t r = 0; r < board_.size(); r++)
+    show_cells(board_.data());
+}
+
+// Current state of puzzle
+board_view solver::board() const
+{
+    if (!loaded_)
+    {
+        return board_view(NULL, 0, 0);
+    }
+    return board_view(board_.data(), nrows_, ncols_);
+}
+
+// Color index of a cell (-1 if not solved)
+int board_view::color(size_t r, size_t c) const
+{
+    uint32_t value = cell(r, c);
+    for (size_t i = 0; i < color_table_size; i++)
+    {
+        if (color_table[i].bitmask == value)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Show a solution found while counting (0 or 1), if there is one
+void solver::show_solution(size_t k)
+{
+    if (solution(k))
+    {
+        show_cells(solution(k));
+    }
+}
+
+// Cells of a solution found while counting (0 or 1), row by row (NULL if
+// not found)
+uint32_t const *solver::solution(size_t k) const
+{
+    if (!counting() || (k >= min(solutions_, (size_t)2)))
+    {
+        return NULL;
+    }
+    return &solution_cells_[k * board_.size()];
+}
+
+// Show cells of a board, row by row
+void solver::show_cells(uint32_t const *cells)
+{
+    for (size_t r = 0; r < nrows_; r++)
     {
-        for (size_t c = 0; c < board_[r].size(); c++)
+        for (size_t c = 0; c < ncols_; c++)
         {
-            uint32_t &value = board_[r][c];
+            uint32_t value = cells[r * ncols_ + c];
 
             // Value a power of two? (identifies single option / solved cell)
             if ((value & (value - 1)) == 0)
@@ -429,265 +1940,308 @@ void solver::color_print(char const *code, char const *text)
     printf("%c[%sm%s", 033, code, text);
 }
 
+// Empty all per-puzzle storage, ready to draw on a fresh arena
+void solver::renew_storage()
+{
+    line_ = line_solver(&arena_);
+    renew(rem_, arena_);
+    renew(dirty_lines_, arena_);
+    renew(line_queued_, arena_);
+    renew(row_rules_, arena_);
+    renew(col_rules_, arena_);
+    renew(line_rules_, arena_);
+    memo_ = line_memo(&arena_);
+    renew(row_patterns_, arena_);
+    renew(col_patterns_, arena_);
+    renew(row_packed_, arena_);
+    renew(col_packed_, arena_);
+    renew(row_ids_, arena_);
+    renew(col_ids_, arena_);
+    renew(row_first_, arena_);
+    renew(col_first_, arena_);
+    renew(row_live_, arena_);
+    renew(col_live_, arena_);
+    set_scratch_ = pattern_set::scratch_t(&arena_);
+    packed_scratch_ = packed_patterns::scratch_t(&arena_);
+    renew(board_, arena_);
+    renew(board_t_, arena_);
+    renew(cell_trail_, arena_);
+    renew(pattern_trail_, arena_);
+    renew(guess_cells_, arena_);
+    renew(guess_order_, arena_);
+    renew(row_counts_, arena_);
+    renew(col_counts_, arena_);
+    renew(probe_seen_, arena_);
+    renew(probe_union_, arena_);
+    renew(probe_count_, arena_);
+    renew(probe_cells_, arena_);
+    probe_serial_ = 0;
+    renew(cell_focus_, arena_);
+    renew(component_root_, arena_);
+    renew(line_cuts_, arena_);
+    renew(option_sort_, arena_);
+    renew(solution_cells_, arena_);
+    renew(count_stack_, arena_);
+}
+
 // Set up puzzle board
 void solver::setup_board()
 {
-    board_.resize(nrows_);
+    board_.assign(nrows_ * ncols_, -1);
+    board_t_.assign(nrows_ * ncols_, -1);
+
+    // Nothing seen yet
+    memo_.resize(memo_slots_, max(nrows_, ncols_));
+
+    // Whole puzzle in focus
+    cell_focus_.assign(nrows_ * ncols_, 0);
+    focus_ = 0;
+    next_focus_ = 1;
+    split_solved_ = 0;
+
+    // Everything needs a first look
+    dirty_lines_.assign(nrows_ + ncols_, 0);
+    dirty_head_ = 0;
+    dirty_count_ = 0;
+    line_queued_.assign(nrows_ + ncols_, false);
     for (size_t r = 0; r < nrows_; r++)
     {
-        board_[r].resize(ncols_);
-        for (size_t c = 0; c < ncols_; c++)
-        {
-            board_[r][c] = -1;
-        }
+        mark_row_dirty(r);
+    }
+    for (size_t c = 0; c < ncols_; c++)
+    {
+        mark_col_dirty(c);
     }
 }
         
 // Generate all possible patterns for all rows and columns
-void solver::generate_all_patterns()
+void solver::generate_all_patterns(puzzle_image const *image)
 {
-    // Generate all row patterns
-    for (size_t i = 0; i < nrows_; i++)
-    {
-        row_patterns_.push_back(generate_patterns(row_rules_[i], ncols_));
-    }
+    PROFILE_STAGE(profile_, STAGE_PATTERNS);
 
-    // Generate all column patterns
-    for (size_t i = 0; i < ncols_; i++)
+    // Line solved directly by DP engine?
+    if (engine_ == ENGINE_DP)
     {
-        col_patterns_.push_back(generate_patterns(col_rules_[i], nrows_));
+        return;
     }
-}
 
-// Generate all possible patterns for rule
-vector<solver::pattern_t> solver::generate_patterns(rule_t &rule, size_t length)
-{
-    // Start with an empty pattern
-    pattern_t empty;
-    empty.resize(length);
-    for (size_t i = 0; i < length; i++)
+    // Look up shared patterns for every row and column (black and white
+    // only? packed down to a bit per cell)
+    if (!cache_ && !own_cache_)
     {
-        empty[i] = 0x01; // bitmask for empty field (white)
+        own_cache_ = make_shared<pattern_cache>();
     }
-
-    // Storage for collecting all possible patterns
-    vector<pattern_t> possible;
-
-    // Recursively generate all patterns
-    recurse_pattern(possible, empty, rule, 0, 0);
-
-    // All done
-    return possible;
-}
-
-// Recursively generate patterns
-void solver::recurse_pattern(vector<pattern_t> &possible, pattern_t ref,
-                             rule_t &rule, size_t pat_idx, size_t rule_idx)
-{
-    // Sanity checks
-    if ((pat_idx >= ref.size()) || (rule_idx >= rule.size()))
+    pattern_cache &cache = cache_ ? *cache_ : *own_cache_;
+    if (image)
     {
-        return;
+        adopt_patterns(*image, cache);
     }
 
-    // Ensure at least one pad space between same color segments
-    if (rule_idx > 0)
+    // Limits apply while generating, as a single set can be huge
+    function<bool()> stop = [this]() { return check_limits(); };
+    row_live_.resize(nrows_);
+    for (size_t i = 0; (i < nrows_) && !load_stopped_; i++)
     {
-        if (rule[rule_idx-1].color_idx == rule[rule_idx].color_idx)
+        if (engine_ == ENGINE_BITS)
         {
-            // Add pad byte
-            pat_idx++;
+            row_packed_.push_back(cache.packed(row_rules_[i], ncols_, &stop));
+            load_stopped_ = !row_packed_[i];
+            row_live_[i] = load_stopped_ ? 0 : row_packed_[i]->size();
         }
-    }
-
-    // Where can we place the next segment?
-    pattern_t cur;
-    for (size_t i = pat_idx; i <= (ref.size() - rule[rule_idx].count); i++)
-    {
-        // Local copy of the reference pattern
-        cur = ref;
-
-        // Stencil in this color segment
-        for (size_t j = 0; j < (size_t)rule[rule_idx].count; j++)
+        else
         {
-            cur[i + j] = color_table[rule[rule_idx].color_idx].bitmask;
+            row_patterns_.push_back(cache.patterns(row_rules_[i], ncols_,
+                                                   &stop));
+            load_stopped_ = !row_patterns_[i];
+            row_live_[i] = load_stopped_ ? 0 : row_patterns_[i]->size();
         }
-
-        // Are we done, or do we recurse?
-        if (rule_idx == rule.size() - 1)
+    }
+    col_live_.resize(ncols_);
+    for (size_t i = 0; (i < ncols_) && !load_stopped_; i++)
+    {
+        if (engine_ == ENGINE_BITS)
         {
-            // Done, add to possible patterns
-            possible.push_back(cur);
+            col_packed_.push_back(cache.packed(col_rules_[i], nrows_, &stop));
+            load_stopped_ = !col_packed_[i];
+            col_live_[i] = load_stopped_ ? 0 : col_packed_[i]->size();
         }
         else
         {
-            // Recurse to next segment
-            recurse_pattern(possible, cur, rule, i + rule[rule_idx].count, rule_idx+1);
+            col_patterns_.push_back(cache.patterns(col_rules_[i], nrows_,
+                                                   &stop));
+            load_stopped_ = !col_patterns_[i];
+            col_live_[i] = load_stopped_ ? 0 : col_patterns_[i]->size();
         }
     }
-}
-
-// Read all row and column rules
-void solver::read_all_rules(char const *filename)
-{
-    // Open file
-    ifstream ifile(filename);
-    if (!ifile.good())
-    {
-        bail("Cannot open file");
-    }
-
-    // Get dimensions
-    read_dims(ifile);
-
-    // Read row rules
-    for (unsigned i = 0; i < nrows_; i++)
+    if (load_stopped_)
     {
-        row_rules_.push_back(read_rule(ifile));
+        row_live_.clear();
+        col_live_.clear();
+        return;
     }
 
-    // Read col rules
-    for (unsigned i = 0; i < ncols_; i++)
-    {
-        col_rules_.push_back(read_rule(ifile));
-    }
+    // Every pattern starts out live
+    number_patterns(row_live_, row_ids_, row_first_);
+    number_patterns(col_live_, col_ids_, col_first_);
+    PROFILE_COUNT(profile_patterns());
 }
 
-// Read puzzle dimensions
-void solver::read_dims(ifstream &ifile)
+// Add pattern sets stored in an image to the cache
+void solver::adopt_patterns(puzzle_image const &image, pattern_cache &cache)
 {
-    vector<string> tokens = read_tokens(ifile);
-    vector<int> dims;
-
-    // Sanity check
-    if (tokens.size() != 2)
-    {
-        bail("Puzzle must have 2 dimensions (first line)");
-    }
-
-    // Convert to strings
-    for (size_t i = 0; i < tokens.size(); i++)
+    bool packed = (engine_ == ENGINE_BITS);
+    for (size_t k = 0; k < image.nsets(); k++)
     {
-        dims.push_back(stoi(tokens[i]));
+        // Sets made for another engine are no use
+        image_set_t const &set = image.set(k);
+        if ((set.packed != 0) != packed)
+        {
+            continue;
+        }
 
-        // Sanity check
-        if (dims[i] == 0)
+        size_t line = set.line;
+        rule_t const &rule = (line < nrows_) ? row_rules_[line]
+                                             : col_rules_[line - nrows_];
+        size_t length = (line < nrows_) ? ncols_ : nrows_;
+        if (!cache.adopt(rule, length, packed, image.set_data(k), set.count,
+                         set.bytes))
         {
-            bail("Puzzle dimensions must be positive");
+            bail("Damaged pattern set in puzzle image");
         }
     }
-
-    // Save results
-    ncols_ = dims[0];
-    nrows_ = dims[1];
 }
 
-// Read row or column rule
-solver::rule_t solver::read_rule(ifstream &ifile)
+// Add patterns generated for each line, and bytes they take, to profile
+void solver::profile_patterns()
 {
-    rule_t rules;
-    rule_element_t next;
-
-    // Default to black (K)
-    next.color_idx = color_table_lookup("K");
-
-    // Read a line of tokens from file
-    vector<string> tokens = read_tokens(ifile);
-
-    // Parse
-    //cout << "Parsing rule" << endl;
-    for (size_t i = 0; i < tokens.size(); i++)
+    // Lines with the same rule share a set, so count each set once
+    vector<bool> seen(nrows_ + ncols_, false);
+    size_t bytes = (row_ids_.size() + col_ids_.size()) * sizeof(uint32_t);
+    for (size_t line = 0; line < nrows_ + ncols_; line++)
     {
-        // Try parsing as an integer
-        if (stoi(tokens[i], next.count))
+        size_t r = line;
+        size_t c = line - nrows_;
+        bool row = (line < nrows_);
+        profile_.count_patterns(line, row ? row_live_[r] : col_live_[c]);
+        if (seen[line_rules_[line]])
         {
-            //cout << "Color idx " << next.color_idx << ", count " << next.count << endl;
-            rules.push_back(next);
+            continue;
         }
-
-        // A color code instead?
-        else if (color_table_lookup(tokens[i].c_str(), next.color_idx))
+        seen[line_rules_[line]] = true;
+        if (engine_ == ENGINE_BITS)
         {
-            // Assignment done via method call
-            //cout << "Switch to color " << next.color_idx << endl;
+            bytes += row ? row_packed_[r]->bytes() : col_packed_[c]->bytes();
         }
-
-        // Neither
         else
         {
-            cerr << "Unexpected token " << tokens[i] << endl;
-            exit(1);
+            bytes += row ? row_patterns_[r]->bytes()
+                         : col_patterns_[c]->bytes();
         }
     }
-
-    return rules;
+    profile_.count_pattern_bytes(bytes);
 }
 
-// Read tokens from a line in file
-vector<string> solver::read_tokens(ifstream &ifile)
+// Give each distinct rule and line length an id
+void solver::number_rules()
 {
-    // Read a line from file
-    string line;
-    getline(ifile, line);
-    if (!ifile)
+    // Rules seen so far, as line ids (few enough to just search)
+    arena_vector<size_t> distinct(&arena_);
+    line_rules_.resize(nrows_ + ncols_);
+    for (size_t line = 0; line < nrows_ + ncols_; line++)
     {
-        bail("Cannot read from file");
-    }
+        rule_t const &rule = (line < nrows_) ? row_rules_[line]
+                                             : col_rules_[line - nrows_];
+        size_t length = (line < nrows_) ? ncols_ : nrows_;
 
-    // Split to tokens
-    return split(line);
+        size_t id;
+        for (id = 0; id < distinct.size(); id++)
+        {
+            size_t other = distinct[id];
+            rule_t const &seen = (other < nrows_) ? row_rules_[other]
+                                                  : col_rules_[other - nrows_];
+            size_t seen_length = (other < nrows_) ? ncols_ : nrows_;
+            if ((seen_length == length) && (seen.size() == rule.size()) &&
+                equal(seen.begin(), seen.end(), rule.begin(),
+                      [](rule_element_t const &a, rule_element_t const &b)
+                      {
+                          return (a.color_idx == b.color_idx) &&
+                                 (a.count == b.count);
+                      }))
+            {
+                break;
+            }
+        }
+        if (id == distinct.size())
+        {
+            distinct.push_back(line);
+        }
+        line_rules_[line] = id;
+    }
 }
 
-// Split string into tokens by spaces
-vector<string> solver::split(std::string data)
+// Read all row and column rules
+void solver::read_all_rules(puzzle_t const &puzzle)
 {
-    vector<string> tokens;
-    size_t pos;
-
-    // Separate at spaces
-    while ((pos = data.find(" ")) != string::npos)
+    ncols_ = puzzle.ncols;
+    nrows_ = puzzle.nrows;
+    if ((ncols_ == 0) || (nrows_ == 0))
     {
-        // Clip first token
-        tokens.push_back(data.substr(0, pos));
-
-        // Repeat with remaining string
-        data = data.substr(pos + 1);
+        bail("Puzzle dimensions must be positive");
     }
-
-    // Add any remaining data
-    if (data.size() > 0)
+    if ((puzzle.first.size() != nrows_ + ncols_ + 1) ||
+        (puzzle.first[nrows_ + ncols_] != puzzle.elements.size()))
     {
-        tokens.push_back(data);
+        bail("Puzzle must have a rule for each row and column");
     }
 
-    return tokens;
-}
-
-// Convert string to integer (w/ check)
-int solver::stoi(std::string &data)
-{
-    int value;
-
-    if (!stoi(data, value))
+    // Rules built in memory may hold anything
+    for (size_t i = 0; i < puzzle.elements.size(); i++)
     {
-        string msg = (string)"Cannot parse " + data + " as integer";
-        bail(msg.c_str());
+        rule_element_t const &element = puzzle.elements[i];
+        if ((element.color_idx < 0) ||
+            ((size_t)element.color_idx >= color_table_size))
+        {
+            bail("Unknown color in rule");
+        }
+        if (element.count < 0)
+        {
+            bail("Rule counts must not be negative");
+        }
     }
 
-    return value;
+    // Row rules, then col rules
+    row_rules_.reserve(nrows_);
+    col_rules_.reserve(ncols_);
+    for (size_t line = 0; line < nrows_ + ncols_; line++)
+    {
+        if (puzzle.first[line] > puzzle.first[line + 1])
+        {
+            bail("Puzzle must have a rule for each row and column");
+        }
+
+        // Built in place, as copies would leave the arena for the heap
+        arena_vector<rule_t> &rules = (line < nrows_) ? row_rules_
+                                                      : col_rules_;
+        rules.emplace_back(puzzle.elements.begin() + puzzle.first[line],
+                           puzzle.elements.begin() + puzzle.first[line + 1],
+                           &arena_);
+    }
 }
 
-// Convert string to integer (w/ check)
-bool solver::stoi(std::string &data, int &value)
+// Read all row and column rules from an image
+void solver::read_all_rules(puzzle_image const &image)
 {
-    char const *expected_end = data.c_str() + data.size();
-    char *actual_end;
-
-    // Do conversion
-    value = strtoul(data.c_str(), &actual_end, 10);
-
-    // Make sure entire buffer was parsed
-    return (actual_end == expected_end);
+    ncols_ = image.ncols();
+    nrows_ = image.nrows();
+    row_rules_.reserve(nrows_);
+    col_rules_.reserve(ncols_);
+    for (size_t line = 0; line < nrows_ + ncols_; line++)
+    {
+        arena_vector<rule_t> &rules = (line < nrows_) ? row_rules_
+                                                      : col_rules_;
+        rules.emplace_back(image.rule_begin(line), image.rule_end(line),
+                           &arena_);
+    }
 }
 
 // Dump an error to screen and stop
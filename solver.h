@@ -1,32 +1,184 @@
 #ifndef SOLVER_H
 #define SOLVER_H
 
-#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include "arena.h"
+#include "line_memo.h"
+#include "line_solver.h"
+#include "observer.h"
+#include "packed_patterns.h"
+#include "pattern_cache.h"
+#include "pattern_set.h"
+#include "profile.h"
+#include "puzzle_builder.h"
+#include "puzzle_image.h"
+#include "puzzle_reader.h"
+#include "task_pool.h"
 
 namespace nonogram
 {
 
+// Line solving engines
+typedef enum
+{
+    ENGINE_PATTERNS, // Enumerate all patterns up front, and prune
+    ENGINE_DP,       // Dynamic programming over placements, no patterns
+    ENGINE_BITS,     // Patterns packed a bit per cell (picked automatically
+                     // over ENGINE_PATTERNS for black and white puzzles)
+} engine_t;
+
+// Branching strategies, for when propagation stalls
+typedef enum
+{
+    BRANCH_FIRST,  // Each pattern of the first unsolved row (DP: each color
+                   // of the first unsolved cell)
+    BRANCH_FEWEST, // Each pattern of the row or column with fewest left
+                   // (DP: each color of the cell with fewest left)
+    BRANCH_CELLS,  // Each color of the cell whose likeliest color, going by
+                   // the live patterns of its row and column, is most
+                   // certain, likeliest first (DP: as BRANCH_FEWEST)
+} branch_t;
+
+// How a solve ended
+typedef enum
+{
+    STATUS_SOLVED,     // All cells solved
+    STATUS_UNSOLVABLE, // Search finished without a solution
+    STATUS_TIMEOUT,    // Stopped early by a limit or the cancel flag, with the
+                       // board as far as deduced before guessing
+    STATUS_INVALID,    // No puzzle loaded, or its rules were rejected
+} status_t;
+
+// Limits on a solve, past which it stops with STATUS_TIMEOUT
+typedef struct
+{
+    double seconds;            // Wall clock time allowed (0 for no limit)
+    unsigned long guesses;     // Guesses allowed (0 for no limit)
+    std::atomic<bool> *cancel; // Stops the solve once set, from any thread
+                               // (NULL for none)
+} limits_t;
+
+// Outcome of a solve
+typedef struct
+{
+    status_t status;       // How it ended
+    bool solved;           // All cells solved
+    double complete;       // Percentage of cells solved
+    double seconds;        // Wall clock time spent solving
+    unsigned long guesses; // Number of guesses tried
+    unsigned long memo_hits;   // Line evaluations answered from memo
+    unsigned long memo_misses; // Line evaluations done in full
+    unsigned long probes;      // Cell colors tried while probing
+    unsigned long components;  // Independent parts searched on their own
+    size_t solutions;          // Solutions found (up to the limit)
+} result_t;
+
+// Read only view of a board, row by row, each cell a bitmask of the
+// colors it may still be (a single color once solved). Good until the
+// solver it came from loads another puzzle.
+class board_view
+{
+public:
+
+    // Constructor
+    board_view(uint32_t const *cells, size_t nrows, size_t ncols)
+        : cells_(cells), nrows_(nrows), ncols_(ncols)
+    {
+    }
+
+    // Dimensions
+    size_t nrows() const { return nrows_; }
+    size_t ncols() const { return ncols_; }
+
+    // Colors a cell may be, as a bitmask
+    uint32_t cell(size_t r, size_t c) const { return cells_[r * ncols_ + c]; }
+
+    // Color index of a cell (-1 if not solved)
+    int color(size_t r, size_t c) const;
+
+    // All cells, row by row
+    uint32_t const *cells() const { return cells_; }
+
+private:
+
+    uint32_t const *cells_;
+    size_t nrows_;
+    size_t ncols_;
+};
+
 class solver
 {
     
-    // Storage for row/col rules
+    // Bitmask patterns for each row/col
+    typedef arena_vector<uint32_t> pattern_t;
+
+    // Undo trail entry (board cell and old mask, or line and old live count)
     typedef struct
     {
-        int color_idx;
-        int count;
-    } rule_element_t;
-    typedef std::vector<rule_element_t> rule_t;
+        size_t index;
+        uint32_t value;
+    } trail_entry_t;
 
-    // Bitmask patterns for each row/col
-    typedef std::vector<uint32_t> pattern_t;
+    // Position in undo trail to roll back to
+    typedef struct
+    {
+        size_t cells;
+        size_t patterns;
+        size_t solved;
+        size_t split;
+    } checkpoint_t;
+
+    // Shared by a solve and all its parallel branches: whether a limit has
+    // stopped it, and guesses made so far
+    typedef struct
+    {
+        std::atomic<bool> stopped;
+        std::atomic<unsigned long> guesses;
+    } stop_state_t;
+
+    // Parallel guess branch, abandoned once an earlier sibling (in guess
+    // order) or an earlier sibling of any parent branch finds a solution
+    struct cancel_token_t
+    {
+        std::atomic<size_t> *best;
+        size_t index;
+        cancel_token_t const *parent;
+
+        bool cancelled() const;
+    };
 
 public:
 
+    // Constructor (load a puzzle later)
+    solver();
+
     // Constructor
-    solver(char const *filename);
+    solver(char const *filename, engine_t engine = ENGINE_PATTERNS);
+
+    // Load a puzzle, reusing storage from any previous one (the first, if
+    // the file holds more than one)
+    void load(char const *filename, engine_t engine = ENGINE_PATTERNS);
+
+    // Load a puzzle already read, reusing storage from any previous one
+    void load(puzzle_t const &puzzle, engine_t engine = ENGINE_PATTERNS);
+
+    // Load a puzzle image, reusing storage from any previous one, and
+    // taking any pattern sets it holds (its rules were checked when it was
+    // written)
+    void load(puzzle_image const &image, engine_t engine = ENGINE_PATTERNS);
+
+    // Load a puzzle from memory, reusing storage from any previous one.
+    // Returns false, with the reason in error(), rather than throwing if
+    // the rules are bad (solving then gives STATUS_INVALID).
+    bool reset(puzzle_t const &puzzle, engine_t engine = ENGINE_PATTERNS);
+
+    // Why the last reset() failed
+    std::string const &error() const { return error_; }
 
     // Implicit destructor
     //~solver();
@@ -34,9 +186,108 @@ public:
     // Run sanity checks
     void sanity();
 
+    // Do all rules use black (K) only?
+    bool black_and_white();
+
+    // Would listing every line's placements take more patterns than the
+    // budget allows?
+    bool over_pattern_budget() const;
+
     // Run solver
     bool run();
 
+    // Run solver, and time it
+    result_t solve();
+
+    // Watch progress (NULL for none, the default)
+    void set_observer(observer *obs) { observer_ = obs; }
+
+    // Run guesses in parallel (NULL for serial search, the default)
+    void set_pool(task_pool *pool) { pool_ = pool; }
+
+    // Share pattern sets through a cache (NULL for a cache of our own, the
+    // default), which applies from the next puzzle loaded
+    void set_cache(pattern_cache *cache) { cache_ = cache; }
+
+    // Number of line memo entries (0 for none), which applies from the next
+    // puzzle loaded
+    void set_memo_size(size_t slots) { memo_slots_ = slots; }
+
+    // Most patterns a puzzle may need, counted over its lines before any are
+    // generated, past which ENGINE_PATTERNS gives way to ENGINE_DP (0 for no
+    // limit), which applies from the next puzzle loaded
+    void set_pattern_budget(size_t patterns) { pattern_budget_ = patterns; }
+
+    // Default pattern budget
+    static size_t const default_pattern_budget = 1 << 24;
+
+    // Engine solving the puzzle loaded, which may differ from the one asked
+    // for (ENGINE_BITS for black and white puzzles, or ENGINE_DP for those
+    // over the pattern budget)
+    engine_t engine() const { return engine_; }
+
+    // Pick lines or cells to guess on (BRANCH_FIRST, the default)
+    void set_branching(branch_t branching) { branching_ = branching; }
+
+    // Time allowed for probing cells each time propagation stalls, before
+    // guessing (0 for no probing, the default)
+    void set_probing(double seconds) { probe_seconds_ = seconds; }
+
+    // Search parts of the puzzle that no longer constrain each other on
+    // their own (true, the default), or the whole puzzle as one
+    void set_decomposition(bool decompose) { decompose_ = decompose; }
+
+    // Share of unsolved cells (as 1 / split_share) to solve before looking
+    // for independent parts again, after a look found none
+    static size_t const split_share = 2;
+
+    // Line evaluations allowed per color probed, per line of the puzzle
+    static size_t const probe_line_limit = 4;
+
+    // Default number of line memo entries
+    static size_t const default_memo_slots = 1 << 14;
+
+    // Stop a solve early, past a deadline or guess budget, or once a flag is
+    // set (no limits, the default). The deadline counts from when the
+    // puzzle started loading, and generating patterns stops at it too,
+    // leaving solve() to report STATUS_TIMEOUT.
+    void set_limits(limits_t const &limits) { limits_ = limits; }
+
+    // Lines evaluated between clock checks while propagating
+    static size_t const stop_check_interval = 256;
+
+    // Count solutions up to limit, keeping the first two (1, the default,
+    // stops at the first, and 2 checks a solution is unique)
+    void set_solution_limit(size_t limit) { solution_limit_ = limit; }
+
+    // Show current state of puzzle
+    void show_board();
+
+    // Current state of puzzle (the first solution found, once solved), or
+    // an empty board if none is loaded
+    board_view board() const;
+
+    // Dimensions
+    size_t nrows() const { return nrows_; }
+    size_t ncols() const { return ncols_; }
+
+    // Show a solution found while counting (0 or 1), if there is one
+    void show_solution(size_t k);
+
+    // Cells of a solution found while counting (0 or 1), row by row (NULL
+    // if not found)
+    uint32_t const *solution(size_t k) const;
+
+    // Time in each stage, and counters, of the last puzzle loaded and
+    // solved (empty unless built with NONOGRAM_PROFILE)
+    profile const &profiling() const { return profile_; }
+
+    // Number of patterns still tracked
+    unsigned long pattern_count() const;
+
+    // Percentage of cells solved
+    double percent_complete() const;
+
     // Debugger
     void dump_rules();
 
@@ -44,75 +295,322 @@ public:
 
 private:
 
-    // Solver stages
-    void apply_row_patterns();
-    void apply_col_patterns();
-    void prune_row_patterns();
-    void prune_col_patterns();
+    // Solver stages (false on contradiction)
+    bool propagate(size_t limit = (size_t)-1);
+    bool probe();
+    bool solve_components(size_t first, size_t count);
+    bool components_parallel(size_t first, size_t count);
+    bool count_components(size_t first, size_t count);
+
+    // Counting solutions, rather than stopping at the first?
+    bool counting() const { return solution_limit_ > 1; }
+
+    // Note a solution of the cells in focus (true if that's enough)
+    bool found_solution();
+    bool apply_row_patterns(size_t r);
+    bool apply_col_patterns(size_t c);
+    bool reduce_row(size_t r, uint32_t *rem);
+    bool reduce_col(size_t c, uint32_t *rem);
+    bool prune_row_patterns(size_t r);
+    bool prune_col_patterns(size_t c);
     void make_a_guess();
 
-    // Stop and display progress
+    // Split unsolved cells in focus into groups that don't constrain each
+    // other, and if more than one, put each in a focus of its own from
+    // next_focus_ on (returns the number of groups)
+    size_t find_components();
+
+    // Root of a cell's group
+    size_t find_root(size_t index);
+
+    // Is a cell (by board index) part of the current search?
+    bool in_focus(size_t index) const
+    {
+        return cell_focus_[index] == focus_;
+    }
+
+    // Does a line hold an unsolved cell in focus?
+    bool line_in_focus(size_t line);
+
+    // Are all cells in focus solved?
+    bool focus_solved();
+
+    // Drop options from first on that repeat an earlier one, keeping order
+    void unique_options(size_t first, size_t length);
+
+    // Add cells changed by one probe (since mark) to the union of colors
+    // seen under each color probed (since serial first)
+    void note_probe(checkpoint_t const &mark, size_t first);
+
+    // Choose a line to guess on (rows, then columns offset by nrows_), and
+    // stack up the options to try (false if solved)
+    bool pick_pattern_guess(size_t &line);
+    bool pick_cell_guess(size_t &line);
+
+    // Unsolved cell whose likeliest color is most certain, with weights of
+    // its colors (nrows_ * ncols_ if all solved)
+    size_t pick_likely_cell(double *weights);
+
+    // Stamp a guess (offset of option in guess_cells_) on a row or column
+    void apply_guess(size_t line, size_t option);
+
+    // Try guesses [first, last) of guess_order_ in order, in place or as
+    // parallel tasks
+    void guess_serial(size_t line, size_t first, size_t last);
+    void guess_parallel(size_t line, size_t first, size_t last);
+
+    // Turn a copy of a solver into an independent search branch
+    void start_branch(cancel_token_t const *token);
+
+    // Take over the cells a search branch solved in a focus (or in any,
+    // for any_focus), through the undo trail if guessing, and queue their
+    // lines so pattern lists catch up when next propagated
+    void merge_branch(solver const &branch, uint32_t focus);
+    static uint32_t const any_focus = ~(uint32_t)0;
+
+    // Has this search branch been abandoned, or the solve stopped?
+    bool cancelled() const;
+
+    // Stop the solve once past its deadline or guess budget (true if
+    // stopped)
+    bool check_limits();
+
+    // Set the deadline, counting from when loading started, and clear any
+    // earlier stop
+    void start_limits();
+
+    // Queue a row/col for re-evaluation
+    void mark_row_dirty(size_t r);
+    void mark_col_dirty(size_t c);
+    void mark_line_dirty(size_t line);
+
+    // Take next line off the queue
+    size_t next_dirty_line();
+
+    // Ids of patterns each row/col still allows
+    uint32_t *row_ids(size_t r) { return row_ids_.data() + row_first_[r]; }
+    uint32_t *col_ids(size_t c) { return col_ids_.data() + col_first_[c]; }
+
+    // Board access
+    uint32_t cell(size_t r, size_t c) const { return board_[r * ncols_ + c]; }
+    uint32_t *row_cells(size_t r) { return &board_[r * ncols_]; }
+    uint32_t *col_cells(size_t c) { return &board_t_[c * nrows_]; }
+
+    // Fix a cell to a narrower set of colors, and queue crossing lines
+    void set_cell(size_t r, size_t c, uint32_t value);
+
+    // Update a cell, keeping solved count and undo trail current
+    void store_cell(size_t r, size_t c, uint32_t value);
+
+    // Save state for a later rollback
+    checkpoint_t checkpoint() const;
+
+    // Undo all changes made since checkpoint
+    void rollback(checkpoint_t const &mark);
+
+    // Report progress to observer, if any
     void pause();
 
-    // Show current state of puzzle
-    void show_board();
+    // Show cells of a board, row by row
+    void show_cells(uint32_t const *cells);
 
     // Emit ANSI console color sequence
     void color_print(char const *code, char const *text);
 
+    // Empty all per-puzzle storage, ready to draw on a fresh arena
+    void renew_storage();
+
+    // Drop previous puzzle, then take rules, check them, and set up the
+    // board
+    void start_load(engine_t engine);
+    void finish_load(puzzle_t const &puzzle);
+
+    // Pick the engine, get patterns (taking any stored in image, if not
+    // NULL), and set up the board
+    void prepare(puzzle_image const *image);
+
     // Set up puzzle board
     void setup_board();
 
-    // Generate all possible patterns for all rows and columns
-    void generate_all_patterns();
+    // Generate all possible patterns for all rows and columns (taking
+    // any stored in image, if not NULL)
+    void generate_all_patterns(puzzle_image const *image);
+
+    // Add pattern sets stored in an image to the cache
+    void adopt_patterns(puzzle_image const &image, pattern_cache &cache);
 
-    // Generate all possible patterns for rule
-    std::vector<pattern_t> generate_patterns(rule_t &rule, size_t length);
+    // Add patterns generated for each line, and bytes they take, to profile
+    void profile_patterns();
 
-    // Recursively generate patterns
-    void recurse_pattern(std::vector<pattern_t> &possible, pattern_t ref,
-                         rule_t &rule, size_t pat_idx, size_t rule_idx);
+    // Give each distinct rule and line length an id
+    void number_rules();
 
-    // Read row or column rule
-    void read_all_rules(char const *filename);
+    // Copy row and column rules
+    void read_all_rules(puzzle_t const &puzzle);
+    void read_all_rules(puzzle_image const &image);
 
-    // Read puzzle dimensions
-    void read_dims(std::ifstream &ifile);
+    // Dump an error to screen and stop
+    void bail(char const *msg);
 
-    // Read row or column rule
-    rule_t read_rule(std::ifstream &ifile);
+    // Storage for everything below that depends on the puzzle (declared
+    // first so it outlives the containers using it)
+    arena arena_;
 
-    // Read from file as a vector of strings
-    std::vector<std::string> read_tokens(std::ifstream &ifile);
+    // Line solving engine
+    engine_t engine_;
+    line_solver line_;
 
-    // Split string into tokens by spaces
-    std::vector<std::string> split(std::string data);
+    // Progress observer (not owned)
+    observer *observer_;
 
-    // Convert string to integer (exit on fail)
-    int stoi(std::string &data);
+    // Parallel search (not owned), and cancellation for this branch
+    task_pool *pool_;
+    cancel_token_t const *cancel_;
 
-    // Convert string to integer (return false on failure)
-    bool stoi(std::string &data, int &value);
+    // Pattern sets shared between lines (not owned), or our own cache when
+    // none is set
+    pattern_cache *cache_;
+    std::shared_ptr<pattern_cache> own_cache_;
 
-    // Dump an error to screen and stop
-    void bail(char const *msg);
+    // Scratch space for union of line possibilities
+    pattern_t rem_;
 
-    // Dimensions
+    // Lines needing re-evaluation (rows, then columns offset by nrows_), as
+    // a ring buffer with room for every line once
+    arena_vector<size_t> dirty_lines_;
+    size_t dirty_head_;
+    size_t dirty_count_;
+    arena_vector<bool> line_queued_;
+
+    // Dimensions, whether a puzzle is loaded and ready to solve, and
+    // whether limits stopped its patterns being generated
     size_t nrows_;
     size_t ncols_;
+    bool loaded_;
+    bool load_stopped_;
 
     //
-    std::vector<rule_t> row_rules_;
-    std::vector<rule_t> col_rules_;
+    arena_vector<rule_t> row_rules_;
+    arena_vector<rule_t> col_rules_;
+
+    // Id of each line's rule (rows, then columns offset by nrows_), the
+    // same for lines with the same rule and length
+    arena_vector<uint32_t> line_rules_;
 
-    std::vector<std::vector<pattern_t> > row_patterns_;
-    std::vector<std::vector<pattern_t> > col_patterns_;
+    // Line filtering results seen before
+    line_memo memo_;
+    size_t memo_slots_;
 
-    // Puzzle board, indexed by rows, then columns
-    std::vector<std::vector<uint32_t> > board_;
+    // Most patterns to generate for a puzzle
+    size_t pattern_budget_;
+
+    // Shared row/col patterns (ENGINE_PATTERNS only)
+    arena_vector<std::shared_ptr<pattern_set const> > row_patterns_;
+    arena_vector<std::shared_ptr<pattern_set const> > col_patterns_;
+
+    // Shared row/col patterns packed a bit per cell (ENGINE_BITS only)
+    arena_vector<std::shared_ptr<packed_patterns const> > row_packed_;
+    arena_vector<std::shared_ptr<packed_patterns const> > col_packed_;
+
+    // Ids of the patterns each row/col still allows, for all rows/cols in
+    // one buffer, starting at row_first_/col_first_
+    arena_vector<uint32_t> row_ids_;
+    arena_vector<uint32_t> col_ids_;
+    arena_vector<size_t> row_first_;
+    arena_vector<size_t> col_first_;
+
+    // Number of ids still live at the front of each row/col list
+    arena_vector<size_t> row_live_;
+    arena_vector<size_t> col_live_;
+
+    // Working space for pattern checks and unions
+    pattern_set::scratch_t set_scratch_;
+    packed_patterns::scratch_t packed_scratch_;
+
+    // Puzzle board, in one buffer indexed by rows, then columns, with a
+    // transposed copy (indexed by columns, then rows) kept in sync so
+    // column passes also scan contiguous memory
+    arena_vector<uint32_t> board_;
+    arena_vector<uint32_t> board_t_;
 
     // Progress counter (number cells solved)
     size_t solved_cells_;
+
+    // Undo trails for speculative guesses
+    size_t guess_depth_;
+    arena_vector<trail_entry_t> cell_trail_;
+    arena_vector<trail_entry_t> pattern_trail_;
+
+    // Options for guesses in progress, stacked by depth, as a line of cells
+    // per option, and option offsets in the order to try them
+    arena_vector<uint32_t> guess_cells_;
+    arena_vector<size_t> guess_order_;
+
+    // Branching strategy, and live pattern color counts for each cell of
+    // each row, and each cell of one column (BRANCH_CELLS only)
+    branch_t branching_;
+    arena_vector<uint32_t> row_counts_;
+    arena_vector<uint32_t> col_counts_;
+
+    // Time allowed for probing, and for each cell, the last probe to touch
+    // it (by serial number), the union of its colors under each color of
+    // the cell being probed, and how many of those colors touched it
+    double probe_seconds_;
+    size_t probe_serial_;
+    arena_vector<size_t> probe_seen_;
+    arena_vector<uint32_t> probe_union_;
+    arena_vector<size_t> probe_count_;
+    arena_vector<size_t> probe_cells_;
+
+    // Whether to split into independent groups, the group being searched,
+    // the next free group number, and each cell's group (all 0 to start)
+    bool decompose_;
+    uint32_t focus_;
+    uint32_t next_focus_;
+    arena_vector<uint32_t> cell_focus_;
+
+    // Number of cells to be solved before looking for groups again
+    size_t split_solved_;
+
+    // Working space for grouping cells, and sorting options
+    arena_vector<size_t> component_root_;
+    arena_vector<uint8_t> line_cuts_;
+    arena_vector<size_t> option_sort_;
+
+    // Most solutions to count, number found so far, the first two found
+    // (as whole boards), and solutions set aside while counting groups
+    size_t solution_limit_;
+    size_t solutions_;
+    arena_vector<uint32_t> solution_cells_;
+    arena_vector<uint32_t> count_stack_;
+
+    // Limits on the solve, when loading started and when it must end by,
+    // state shared with parallel branches, and calls since the clock was
+    // last checked
+    limits_t limits_;
+    std::chrono::steady_clock::time_point load_start_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::shared_ptr<stop_state_t> stop_;
+    size_t stop_checks_;
+
+    // Number of guesses tried
+    unsigned long guesses_;
+
+    // Number of line evaluations answered from memo, and done in full
+    unsigned long memo_hits_;
+    unsigned long memo_misses_;
+
+    // Number of cell colors probed
+    unsigned long probes_;
+
+    // Number of independent groups searched on their own
+    unsigned long components_;
+
+    // Time in each stage, and counters
+    profile profile_;
+
+    // Why the last reset() failed
+    std::string error_;
 };
 
 };
@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "puzzle_builder.h"
+#include "solver.h"
+#include "tools.h"
+using namespace std;
+using namespace nonogram;
+
+// Pool whose idle hint follows a seeded random schedule, so work is handed
+// off (or not) at every point the solver asks, whatever the real load
+class scripted_pool : public task_pool
+{
+public:
+
+    // Start worker threads, with a schedule seed
+    scripted_pool(unsigned nthreads, unsigned seed)
+        : task_pool(nthreads), seed_(seed), calls_(0)
+    {
+    }
+
+    // Hand work off?
+    virtual bool has_idle() const
+    {
+        unsigned long call = calls_++;
+        return ((minstd_rand(seed_ + call)() >> 15) & 1) != 0;
+    }
+
+private:
+
+    unsigned seed_;
+    mutable atomic<unsigned long> calls_;
+};
+
+// Does a solved board match every rule of a puzzle?
+static bool matches(puzzle_t const &puzzle, board_view const &board)
+{
+    for (size_t line = 0; line < puzzle.nrows + puzzle.ncols; line++)
+    {
+        bool row = (line < puzzle.nrows);
+        size_t length = row ? puzzle.ncols : puzzle.nrows;
+        vector<rule_element_t> runs;
+        int prev = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            int color = row ? board.color(line, i)
+                            : board.color(i, line - puzzle.nrows);
+            if (color < 0)
+            {
+                return false;
+            }
+            if ((color > 0) && (color == prev))
+            {
+                runs.back().count++;
+            }
+            else if (color > 0)
+            {
+                rule_element_t element = { color, 1 };
+                runs.push_back(element);
+            }
+            prev = color;
+        }
+
+        size_t first = puzzle.first[line];
+        if (runs.size() != puzzle.first[line + 1] - first)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            if ((runs[i].color_idx != puzzle.elements[first + i].color_idx) ||
+                (runs[i].count != puzzle.elements[first + i].count))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Solve random puzzles with guesses handed to the pool on random
+// schedules, so parallel guesses end up nested in serial ones and in
+// searches of independent parts, whose rollbacks must undo them
+static int test_parallel()
+{
+    static engine_t const engines[] = { ENGINE_PATTERNS, ENGINE_DP };
+    int failures = 0;
+    size_t runs = 0;
+    puzzle_t puzzle;
+    for (unsigned seed = 1; seed <= 12; seed++)
+    {
+        size_t size = 15 + seed % 6;
+        random_puzzle(puzzle, size, size, 1 + seed % 2, 55, seed);
+        for (size_t e = 0; e < 2; e++)
+        {
+            for (unsigned nthreads = 2; nthreads <= 4; nthreads++)
+            {
+                for (unsigned schedule = 0; schedule < 4; schedule++)
+                {
+                    scripted_pool pool(nthreads, schedule * 7919 + seed);
+                    solver app;
+                    app.set_pool(&pool);
+                    app.load(puzzle, engines[e]);
+                    result_t result = app.solve();
+                    runs++;
+                    if (!result.solved || !matches(puzzle, app.board()))
+                    {
+                        printf("FAIL puzzle %u, engine %zu, %u threads,"
+                               " schedule %u\n", seed, e, nthreads,
+                               schedule);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    printf("%zu parallel solves\n", runs);
+    return failures;
+}
+
+// Count a failed check, naming it
+static int check(bool ok, char const *what)
+{
+    if (!ok)
+    {
+        printf("FAIL %s\n", what);
+    }
+    return ok ? 0 : 1;
+}
+
+// Does reset() reject a puzzle, with message in the error, leaving nothing
+// loaded to solve?
+static bool rejects(solver &app, puzzle_t const &puzzle, char const *message)
+{
+    if (app.reset(puzzle))
+    {
+        return false;
+    }
+    if (app.error().find(message) == string::npos)
+    {
+        printf("     error was: %s\n", app.error().c_str());
+        return false;
+    }
+    return (app.solve().status == STATUS_INVALID) &&
+           (app.board().nrows() == 0);
+}
+
+// Reject bad dimensions and rules through reset(), and reuse storage for
+// the next puzzle once it has seen one as big
+static int test_reset()
+{
+    int failures = 0;
+    solver app;
+    puzzle_t puzzle;
+
+    puzzle_builder(puzzle, 0, 1).rule({});
+    failures += check(rejects(app, puzzle, "dimensions must be positive"),
+                      "reset: no columns");
+    puzzle_builder(puzzle, 2, 2).rule({ 1 }).rule({ 1 }).rule({ 1 });
+    failures += check(rejects(app, puzzle, "a rule for each row and column"),
+                      "reset: rule missing");
+    puzzle_builder(puzzle, 1, 1).rule({ 1 }).rule({ 1 }).rule({ 1 });
+    failures += check(rejects(app, puzzle, "a rule for each row and column"),
+                      "reset: rule too many");
+    puzzle_builder(puzzle, 2, 1).rule({ 1 }).rule({ 1 }).rule({ 1 });
+    puzzle.first[1] = 3;
+    failures += check(rejects(app, puzzle, "a rule for each row and column"),
+                      "reset: rules out of order");
+    puzzle_builder(puzzle, 1, 1).next_rule().segment(1, "Q").rule({ 1 });
+    failures += check(rejects(app, puzzle, "Unknown color"),
+                      "reset: unknown color token");
+    puzzle_builder(puzzle, 1, 1).rule({ 1 }).rule({ 1 });
+    puzzle.elements[1].color_idx = 99;
+    failures += check(rejects(app, puzzle, "Unknown color"),
+                      "reset: color index out of range");
+    puzzle_builder(puzzle, 1, 1).rule({ -1 }).rule({ -1 });
+    failures += check(rejects(app, puzzle, "must not be negative"),
+                      "reset: negative count");
+    puzzle_builder(puzzle, 2, 1).rule({ 2 }).rule({ 1 }).rule({ 0 });
+    failures += check(rejects(app, puzzle, "imbalance"),
+                      "reset: colors don't add up");
+
+    // A good puzzle loads after a bad one
+    puzzle_builder(puzzle, 2, 2).rule({ 2 }).rule({ 1 })
+                                .rule({ 2 }).rule({ 1 });
+    failures += check(app.reset(puzzle) && app.error().empty() &&
+                      app.solve().solved && matches(puzzle, app.board()),
+                      "reset: good puzzle after bad");
+
+    // Storage settles once the solver has seen a puzzle this big (and
+    // merged the arena blocks it took into one, on the next load), and the
+    // cache holds its rules (DP keeps no patterns, so a smaller puzzle
+    // needs nothing new at all)
+    static engine_t const engines[] = { ENGINE_PATTERNS, ENGINE_DP };
+    for (size_t e = 0; e < 2; e++)
+    {
+        puzzle_t big;
+        puzzle_t small;
+        random_puzzle(big, 30, 25, 2, 55, 3);
+        random_puzzle(small, 20, 20, 2, 55, 4);
+        solver reused;
+        bool solved = true;
+        unsigned long allocations[5];
+        for (size_t run = 0; run < 5; run++)
+        {
+            unsigned long before = arena::heap_allocations();
+            solved = solved && reused.reset((run < 3) ? big : small,
+                                            engines[e]) &&
+                     reused.solve().solved;
+            allocations[run] = arena::heap_allocations() - before;
+        }
+        bool settled = (allocations[2] == 0) && (allocations[4] == 0) &&
+                       ((engines[e] != ENGINE_DP) || (allocations[3] == 0));
+        if (!solved || !settled)
+        {
+            printf("     heap allocations %lu %lu %lu %lu %lu\n",
+                   allocations[0], allocations[1], allocations[2],
+                   allocations[3], allocations[4]);
+        }
+        failures += check(solved && settled, (e == 0)
+                          ? "reset: storage reused (patterns)"
+                          : "reset: storage reused (dp)");
+    }
+    return failures;
+}
+
+// Count solutions of a puzzle with 5! of them (one cell filled in each
+// row and column), up to various limits: counting stops at the limit, and
+// keeps the first two solutions found, both valid and different, with
+// either engine, serial or parallel
+static int test_solution_limit()
+{
+    static engine_t const engines[] = { ENGINE_PATTERNS, ENGINE_DP };
+    static size_t const limits[] = { 1, 2, 3, 7, 120, 1000 };
+    int failures = 0;
+    puzzle_t puzzle;
+    puzzle_builder build(puzzle, 5, 5);
+    for (size_t line = 0; line < 10; line++)
+    {
+        build.rule({ 1 });
+    }
+
+    for (size_t e = 0; e < 2; e++)
+    {
+        for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++)
+        {
+            for (unsigned nthreads = 0; nthreads <= 3; nthreads += 3)
+            {
+                scripted_pool pool(nthreads, l + 1);
+                solver app;
+                app.set_pool(nthreads ? &pool : NULL);
+                app.set_solution_limit(limits[l]);
+                app.reset(puzzle, engines[e]);
+                result_t result = app.solve();
+
+                size_t expected = min(limits[l], (size_t)120);
+                bool ok = (result.solutions == expected) &&
+                          (result.status != STATUS_TIMEOUT) &&
+                          matches(puzzle, app.board());
+                for (size_t k = 0; (limits[l] > 1) && (k < 2); k++)
+                {
+                    uint32_t const *cells = app.solution(k);
+                    ok = ok && (cells != NULL) &&
+                         matches(puzzle, board_view(cells, 5, 5));
+                }
+                if (ok && (limits[l] > 1))
+                {
+                    ok = (memcmp(app.solution(0), app.solution(1),
+                                 25 * sizeof(uint32_t)) != 0);
+                }
+                if (!ok)
+                {
+                    printf("FAIL limit %zu, engine %zu, %u threads: %zu"
+                           " solutions\n", limits[l], e, nthreads,
+                           result.solutions);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    // A unique puzzle counts one, with no second solution
+    puzzle_builder(puzzle, 2, 2).rule({ 2 }).rule({ 1 })
+                                .rule({ 2 }).rule({ 1 });
+    solver app;
+    app.set_solution_limit(2);
+    app.reset(puzzle);
+    result_t result = app.solve();
+    failures += check((result.solutions == 1) && (app.solution(0) != NULL) &&
+                      (app.solution(1) == NULL), "limit: unique puzzle");
+    return failures;
+}
+
+// Does a solve under limits stop with STATUS_TIMEOUT, within seconds of
+// starting to load?
+static bool times_out(puzzle_t const &puzzle, limits_t const &limits,
+                      size_t solution_limit, double seconds)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    solver app;
+    app.set_limits(limits);
+    app.set_solution_limit(solution_limit);
+    app.reset(puzzle);
+    result_t result = app.solve();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    if ((limits.guesses > 0) && (result.guesses > limits.guesses))
+    {
+        return false;
+    }
+    return (result.status == STATUS_TIMEOUT) && (elapsed.count() < seconds);
+}
+
+// Stop solves past a guess budget, a deadline (while searching, and while
+// generating patterns), or once the cancel flag is set
+static int test_limits()
+{
+    int failures = 0;
+
+    // One cell filled in each row and column: 12! solutions to count
+    puzzle_t many;
+    puzzle_builder build(many, 12, 12);
+    for (size_t line = 0; line < 24; line++)
+    {
+        build.rule({ 1 });
+    }
+    limits_t guesses = { 0, 5, NULL };
+    failures += check(times_out(many, guesses, 1000000000, 10),
+                      "limits: guess budget");
+    limits_t deadline = { 0.05, 0, NULL };
+    failures += check(times_out(many, deadline, 1000000000, 10),
+                      "limits: deadline while searching");
+    atomic<bool> cancel(true);
+    limits_t cancelled = { 0, 0, &cancel };
+    failures += check(times_out(many, cancelled, 1000000000, 10),
+                      "limits: cancel flag");
+
+    // A row of five scattered cells in 70, with almost nine million
+    // placements (within the pattern budget, but seconds to generate), so
+    // the deadline passes long before they are all generated
+    puzzle_t wide;
+    puzzle_builder row(wide, 70, 1);
+    row.rule({ 1, 1, 1, 1, 1 });
+    for (size_t c = 0; c < 70; c++)
+    {
+        row.rule(((c % 10 == 0) && (c < 50)) ? vector<int>(1, 1)
+                                             : vector<int>());
+    }
+    limits_t now = { 1e-6, 0, NULL };
+    failures += check(times_out(wide, now, 1, 0.25),
+                      "limits: deadline while generating patterns");
+
+    // Limits that aren't reached leave the solve alone
+    limits_t loose = { 60, 1000000, NULL };
+    solver app;
+    app.set_limits(loose);
+    app.reset(many);
+    failures += check(app.solve().status == STATUS_SOLVED,
+                      "limits: not reached");
+    return failures;
+}
+
+// Run each group of tests
+int main()
+{
+    int failures = test_parallel() + test_reset() + test_solution_limit() +
+                   test_limits();
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+#include "task_pool.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Worker identity for calling thread
+static thread_local task_pool const *current_pool = NULL;
+static thread_local size_t current_index = 0;
+
+// Start worker threads
+task_pool::task_pool(unsigned nthreads)
+    : idle_(0), queued_(0), stop_(false), waiting_(0)
+{
+    for (size_t i = 0; i <= nthreads; i++)
+    {
+        queues_.push_back(new queue_t);
+    }
+    for (size_t i = 0; i < nthreads; i++)
+    {
+        threads_.push_back(thread(&task_pool::worker, this, i));
+    }
+}
+
+// Stop worker threads (pending tasks are dropped)
+task_pool::~task_pool()
+{
+    {
+        lock_guard<mutex> lock(sleep_lock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        threads_[i].join();
+    }
+    for (size_t i = 0; i < queues_.size(); i++)
+    {
+        delete queues_[i];
+    }
+}
+
+// Queue a task
+void task_pool::submit(task_t const &task)
+{
+    // Count it first, so a thief can never see it before it is counted
+    {
+        lock_guard<mutex> lock(sleep_lock_);
+        queued_++;
+    }
+
+    queue_t &queue = *queues_[self()];
+    {
+        lock_guard<mutex> lock(queue.lock);
+        queue.tasks.push_back(task);
+    }
+
+    // Wake a sleeping worker to come steal it, and any waiting thread, as
+    // it may be the only one free
+    wake_.notify_one();
+    if (waiting_ > 0)
+    {
+        finished_.notify_all();
+    }
+}
+
+// Run queued tasks on calling thread until done() is true
+void task_pool::wait_until(function<bool()> const &done)
+{
+    size_t me = self();
+    while (!done())
+    {
+        if (run_one(me))
+        {
+            continue;
+        }
+
+        // Nothing to help with, so sleep until a task finishes (done()
+        // only changes then) or more show up
+        unique_lock<mutex> lock(sleep_lock_);
+        waiting_++;
+        finished_.wait(lock, [&]() { return queued_ > 0 || done(); });
+        waiting_--;
+    }
+}
+
+// Worker thread main loop
+void task_pool::worker(size_t self)
+{
+    current_pool = this;
+    current_index = self;
+
+    while (!stop_)
+    {
+        if (run_one(self))
+        {
+            continue;
+        }
+
+        // Nothing anywhere, sleep until more work shows up
+        unique_lock<mutex> lock(sleep_lock_);
+        idle_++;
+        wake_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+        idle_--;
+    }
+}
+
+// Run one task, our own newest first, else steal the oldest elsewhere
+bool task_pool::run_one(size_t self)
+{
+    task_t task;
+    bool found = false;
+
+    for (size_t i = 0; !found && (i < queues_.size()); i++)
+    {
+        queue_t &queue = *queues_[(self + i) % queues_.size()];
+        lock_guard<mutex> lock(queue.lock);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+
+    if (!found)
+    {
+        return false;
+    }
+
+    queued_--;
+    task();
+
+    // Wake waiting threads to check on it, taking the lock so none can be
+    // between checking and sleeping
+    if (waiting_ > 0)
+    {
+        lock_guard<mutex> lock(sleep_lock_);
+        finished_.notify_all();
+    }
+    return true;
+}
+
+// Deque index for calling thread
+size_t task_pool::self() const
+{
+    if (current_pool == this)
+    {
+        return current_index;
+    }
+    return queues_.size() - 1;
+}
+
+};
@@ -0,0 +1,83 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nonogram
+{
+
+// Work-stealing thread pool
+//
+// Each worker keeps its own deque of tasks. New tasks go to the bottom of
+// the submitting worker's deque, and are run from the bottom (newest, so
+// depth first), while idle workers steal from the top of another worker's
+// deque (oldest, so the largest pieces of work). Threads outside the pool
+// share one extra deque.
+class task_pool
+{
+public:
+
+    typedef std::function<void()> task_t;
+
+    // Start worker threads
+    task_pool(unsigned nthreads);
+
+    // Stop worker threads (pending tasks are dropped)
+    virtual ~task_pool();
+
+    // Queue a task
+    void submit(task_t const &task);
+
+    // Run queued tasks on calling thread until done() is true, sleeping
+    // whenever there are none to run (done() must only change as a task
+    // finishes)
+    void wait_until(std::function<bool()> const &done);
+
+    // Any worker waiting for something to do? Only a hint of whether to
+    // hand work off, so a test may override it to force either choice
+    virtual bool has_idle() const { return idle_ > 0; }
+
+private:
+
+    // Per-worker task deque
+    typedef struct
+    {
+        std::mutex lock;
+        std::deque<task_t> tasks;
+    } queue_t;
+
+    // Worker thread main loop
+    void worker(size_t self);
+
+    // Run one task, our own newest first, else steal the oldest elsewhere
+    bool run_one(size_t self);
+
+    // Deque index for calling thread
+    size_t self() const;
+
+    // Task deques (last one is shared by threads outside pool)
+    std::vector<queue_t *> queues_;
+    std::vector<std::thread> threads_;
+
+    // Sleeping workers, and tasks queued but not yet started
+    std::atomic<int> idle_;
+    std::atomic<size_t> queued_;
+    std::atomic<bool> stop_;
+    std::mutex sleep_lock_;
+    std::condition_variable wake_;
+
+    // Threads sleeping in wait_until(), woken as tasks finish or are
+    // queued
+    std::atomic<int> waiting_;
+    std::condition_variable finished_;
+};
+
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <glob.h>
+#include <sys/stat.h>
+#include "puzzle_builder.h"
+#include "tools.h"
+using namespace std;
+
+namespace nonogram
+{
+
+// Engine picked by name
+bool engine_named(char const *name, engine_t &engine)
+{
+    if (strcmp(name, "patterns") == 0)
+    {
+        engine = ENGINE_PATTERNS;
+    }
+    else if (strcmp(name, "dp") == 0)
+    {
+        engine = ENGINE_DP;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Name of an engine
+char const *engine_name(engine_t engine)
+{
+    return (engine == ENGINE_DP) ? "dp" : "patterns";
+}
+
+// Branching strategy picked by name
+bool branching_named(char const *name, branch_t &branching)
+{
+    if (strcmp(name, "first") == 0)
+    {
+        branching = BRANCH_FIRST;
+    }
+    else if (strcmp(name, "fewest") == 0)
+    {
+        branching = BRANCH_FEWEST;
+    }
+    else if (strcmp(name, "cells") == 0)
+    {
+        branching = BRANCH_CELLS;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Board as a JSON array of rows of color indexes
+string board_json(board_view const &board)
+{
+    string out = "[";
+    char buf[16];
+    for (size_t r = 0; r < board.nrows(); r++)
+    {
+        out += (r > 0) ? ",[" : "[";
+        for (size_t c = 0; c < board.ncols(); c++)
+        {
+            snprintf(buf, sizeof(buf), "%s%d", (c > 0) ? "," : "",
+                     board.color(r, c));
+            out += buf;
+        }
+        out += "]";
+    }
+    return out + "]";
+}
+
+// First two solutions found while counting, as a JSON array of boards
+string solutions_json(solver const &app)
+{
+    string out = "[";
+    for (size_t k = 0; app.solution(k); k++)
+    {
+        board_view board(app.solution(k), app.nrows(), app.ncols());
+        out += (k > 0) ? "," : "";
+        out += board_json(board);
+    }
+    return out + "]";
+}
+
+// Whole number given for an option
+bool option_number(char const *text, unsigned long low, unsigned long high,
+                   unsigned long &value)
+{
+    // strtoul() would take spaces and a minus sign
+    if ((*text < '0') || (*text > '9'))
+    {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    value = strtoul(text, &end, 10);
+    return (*end == 0) && (errno == 0) && (value >= low) && (value <= high);
+}
+
+// Add all paths matching a glob pattern
+static void add_glob(vector<string> &files, string const &pattern)
+{
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, NULL, &matches) == 0)
+    {
+        for (size_t i = 0; i < matches.gl_pathc; i++)
+        {
+            files.push_back(matches.gl_pathv[i]);
+        }
+    }
+    globfree(&matches);
+}
+
+// Add a directory, glob, or single puzzle to a list of files
+void add_path(vector<string> &files, string const &path)
+{
+    struct stat info;
+    if ((stat(path.c_str(), &info) == 0) && S_ISDIR(info.st_mode))
+    {
+        add_glob(files, path + "/*.in");
+        add_glob(files, path + "/*.nonb");
+    }
+    else if (path.find_first_of("*?[") != string::npos)
+    {
+        add_glob(files, path);
+    }
+    else
+    {
+        files.push_back(path);
+    }
+}
+
+// Fill in a puzzle from a random board
+void random_puzzle(puzzle_t &puzzle, size_t ncols, size_t nrows,
+                   size_t ncolors, unsigned fill, unsigned seed)
+{
+    static char const *const colors[] = { "K", "R", "G", "B" };
+    ncolors = min(ncolors, sizeof(colors) / sizeof(colors[0]));
+
+    // mt19937 gives the same numbers everywhere, unlike the distributions
+    mt19937 random(seed);
+    vector<size_t> cells(ncols * nrows);
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        cells[i] = 0;
+        if (random() % 100 < fill)
+        {
+            cells[i] = 1 + random() % ncolors;
+        }
+    }
+
+    // Runs of each color along each row, then each column
+    puzzle_builder build(puzzle, ncols, nrows);
+    for (size_t line = 0; line < nrows + ncols; line++)
+    {
+        bool row = (line < nrows);
+        size_t length = row ? ncols : nrows;
+        build.next_rule();
+        size_t run = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            size_t cell = row ? cells[line * ncols + i] :
+                                cells[i * ncols + line - nrows];
+            size_t next = (i + 1 == length) ? 0 :
+                row ? cells[line * ncols + i + 1] :
+                      cells[(i + 1) * ncols + line - nrows];
+            run++;
+            if (cell != next)
+            {
+                if (cell)
+                {
+                    build.segment(run, colors[cell - 1]);
+                }
+                run = 0;
+            }
+        }
+    }
+}
+
+};
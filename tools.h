@@ -0,0 +1,52 @@
+#ifndef TOOLS_H
+#define TOOLS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "puzzle_reader.h"
+#include "solver.h"
+
+namespace nonogram
+{
+
+// Helpers shared by the command line tools, the server, and tests
+
+// Engine picked by name, "patterns" or "dp" (false for any other)
+bool engine_named(char const *name, engine_t &engine);
+
+// Name of an engine, as engine_named() takes it
+char const *engine_name(engine_t engine);
+
+// Branching strategy picked by name, "first", "fewest" or "cells" (false
+// for any other)
+bool branching_named(char const *name, branch_t &branching);
+
+// Board as a JSON array of rows of color indexes (-1 for cells not solved)
+std::string board_json(board_view const &board);
+
+// First two solutions found while counting, as a JSON array of boards
+// (empty if not counting)
+std::string solutions_json(solver const &app);
+
+// Most worker threads an option may ask for
+unsigned const max_threads = 1024;
+
+// Whole number given for an option, from low to high (false for anything
+// else, such as a sign, a fraction or trailing text)
+bool option_number(char const *text, unsigned long low, unsigned long high,
+                   unsigned long &value);
+
+// Add a directory (its text puzzles and binary images), glob, or single
+// puzzle to a list of files
+void add_path(std::vector<std::string> &files, std::string const &path);
+
+// Fill in a puzzle from a random board of ncols by nrows cells, fill
+// percent of them filled in one of ncolors colors (up to four), so it has
+// at least one solution. The same seed gives the same puzzle everywhere.
+void random_puzzle(puzzle_t &puzzle, size_t ncols, size_t nrows,
+                   size_t ncolors, unsigned fill, unsigned seed);
+
+};
+
+#endif